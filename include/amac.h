@@ -0,0 +1,73 @@
+#pragma once
+#include <coroutine>
+#include <cstddef>
+#include <exception>
+#include <utility>
+#include <vector>
+
+namespace cuckoo {
+
+// Asynchronous memory access chaining (AMAC) on C++20 coroutines.
+//
+// A lookup stream is a coroutine that walks a share of a batch of keys. For
+// each key it prefetches the cache lines it is about to read, suspends, and
+// reads them when resumed. amac_run() keeps a group of streams in flight and
+// resumes them round robin, so by the time a stream comes back to its key the
+// other streams have issued their own prefetches and the misses overlap
+// instead of stalling one after another.
+class amac_task {
+public:
+    struct promise_type {
+      amac_task get_return_object() {
+        return amac_task(std::coroutine_handle<promise_type>::from_promise(*this));
+      }
+      std::suspend_always initial_suspend() noexcept { return {}; }
+      std::suspend_always final_suspend() noexcept { return {}; }
+      void return_void() {}
+      void unhandled_exception() { std::terminate(); }
+    };
+
+    amac_task(amac_task&& other) noexcept : handle(std::exchange(other.handle, {})) {}
+    amac_task(const amac_task&) = delete;
+    amac_task& operator=(const amac_task&) = delete;
+    ~amac_task() { if (handle) handle.destroy(); }
+
+    bool done() const { return handle.done(); }
+    void resume() { handle.resume(); }
+
+private:
+    explicit amac_task(std::coroutine_handle<promise_type> h) : handle(h) {}
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+// Suspension point between issuing a prefetch and using the data.
+using amac_yield = std::suspend_always;
+
+// Lookups kept in flight by default. Each has two misses outstanding and a
+// core tracks only 10-20, so larger groups mostly add resume overhead.
+inline constexpr size_t AMAC_GROUP = 8;
+
+// Runs make_stream(g) for g in [0, group) to completion, interleaved.
+template<typename MakeStream>
+void amac_run(size_t group, MakeStream&& make_stream) {
+    std::vector<amac_task> streams;
+    streams.reserve(group);
+    for (size_t g = 0; g < group; ++g) streams.push_back(make_stream(g));
+
+    size_t live = group;
+    while (live > 0) {
+      for (amac_task& s : streams) {
+        if (s.done()) continue;
+        s.resume();
+        if (s.done()) --live;
+      }
+    }
+}
+
+template<typename T>
+inline void prefetch(const T* p) {
+    __builtin_prefetch(p, 0, 3);
+}
+
+} // namespace cuckoo
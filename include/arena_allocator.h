@@ -0,0 +1,127 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <vector>
+
+namespace cuckoo {
+
+// Bump allocator over large slabs. Each thread carves its allocations out of
+// a slab of its own, so threads only meet on the slab list when they need a
+// new one. Nothing is freed individually: every slab is released at once when
+// the arena is destroyed.
+class arena {
+public:
+    static constexpr size_t SLAB_SIZE = size_t(256) << 10;
+
+    arena() : id(next_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+    ~arena() {
+      for (void* slab : slabs) ::operator delete(slab);
+    }
+
+    arena(const arena&) = delete;
+    arena& operator=(const arena&) = delete;
+
+    void* allocate(size_t bytes, size_t align) {
+      // large requests get a slab to themselves
+      if (bytes > SLAB_SIZE / 4) return new_slab(bytes);
+
+      cursor& c = cache[id % CACHE_WAYS];
+      if (c.owner == id) {
+        uintptr_t p = (c.next + align - 1) & ~uintptr_t(align - 1);
+        if (p + bytes <= c.end) {
+          c.next = p + bytes;
+          return reinterpret_cast<void*>(p);
+        }
+      }
+      // start a fresh slab; the tail of the old one is abandoned
+      uintptr_t base = reinterpret_cast<uintptr_t>(new_slab(SLAB_SIZE));
+      uintptr_t p = (base + align - 1) & ~uintptr_t(align - 1);
+      c.owner = id;
+      c.next = p + bytes;
+      c.end = base + SLAB_SIZE;
+      return reinterpret_cast<void*>(p);
+    }
+
+    size_t bytes_reserved() const {
+      std::unique_lock<std::mutex> lock(mtx);
+      return reserved;
+    }
+
+private:
+    // Per-thread bump cursors for the last few arenas a thread used. Ids start
+    // at 1 and are never reused, so a zeroed cursor or one left behind by a
+    // destroyed arena can only miss.
+    struct cursor {
+      uint64_t owner;
+      uintptr_t next;
+      uintptr_t end;
+    };
+    static constexpr size_t CACHE_WAYS = 8;
+
+    void* new_slab(size_t bytes) {
+      void* slab = ::operator new(bytes);
+      std::unique_lock<std::mutex> lock(mtx);
+      slabs.push_back(slab);
+      reserved += bytes;
+      return slab;
+    }
+
+    const uint64_t id;
+    mutable std::mutex mtx;
+    std::vector<void*> slabs;
+    size_t reserved = 0;
+
+    inline static std::atomic<uint64_t> next_id{1};
+    inline static thread_local cursor cache[CACHE_WAYS];
+};
+
+// Allocator handing out memory from a shared arena. deallocate() is a no-op;
+// storage is reclaimed when the last allocator referring to the arena goes
+// away. The engines start a new arena for the table built by each resize
+// (see next_generation below), so the old table's buckets are freed in bulk
+// as soon as the resize drops it.
+template<typename T>
+class arena_allocator {
+public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+    using is_always_equal = std::false_type;
+
+    arena_allocator() : arena_(std::make_shared<arena>()) {}
+
+    template<typename U>
+    arena_allocator(const arena_allocator<U>& other) : arena_(other.arena_) {}
+
+    T* allocate(size_t n) {
+      return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T*, size_t) {}
+
+    // Same element type, empty arena.
+    arena_allocator fresh() const { return arena_allocator(); }
+
+    size_t bytes_reserved() const { return arena_->bytes_reserved(); }
+
+    template<typename U>
+    bool operator==(const arena_allocator<U>& other) const { return arena_ == other.arena_; }
+
+private:
+    template<typename U> friend class arena_allocator;
+
+    std::shared_ptr<arena> arena_;
+};
+
+template<typename T>
+arena_allocator<T> next_generation(const arena_allocator<T>& alloc) {
+    return alloc.fresh();
+}
+
+} // namespace cuckoo
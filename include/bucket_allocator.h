@@ -0,0 +1,110 @@
+#pragma once
+#include <sys/mman.h>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace cuckoo {
+
+// How bucket arrays of HUGE_PAGE_SIZE bytes or more are backed. Smaller
+// arrays always come from operator new.
+enum class page_mode {
+    standard,          // mmap, the kernel's default page policy
+    transparent_huge,  // mmap + madvise(MADV_HUGEPAGE)
+    hugetlb            // mmap(MAP_HUGETLB), else falls back to transparent_huge
+};
+
+inline constexpr size_t HUGE_PAGE_SIZE = size_t(2) << 20;
+
+inline std::atomic<page_mode> bucket_page_mode{page_mode::standard};
+
+// Selects the backing of bucket arrays allocated from now on. A table keeps
+// the pages it has until its next resize.
+inline void set_bucket_pages(page_mode mode) {
+    bucket_page_mode.store(mode, std::memory_order_relaxed);
+}
+
+inline page_mode bucket_pages() {
+    return bucket_page_mode.load(std::memory_order_relaxed);
+}
+
+// Whole huge pages mapped for a large array. Mappings are aligned to
+// HUGE_PAGE_SIZE so transparent huge pages can back them from the first byte.
+inline void* map_buckets(size_t bytes) {
+    size_t len = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    page_mode mode = bucket_pages();
+
+#ifdef MAP_HUGETLB
+    if (mode == page_mode::hugetlb) {
+      void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+      if (p != MAP_FAILED) return p;
+      // no reserved huge pages (vm.nr_hugepages)
+      mode = page_mode::transparent_huge;
+    }
+#endif
+
+    void* raw = mmap(nullptr, len + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE,
+                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (raw == MAP_FAILED) throw std::bad_alloc();
+    uintptr_t start = reinterpret_cast<uintptr_t>(raw);
+    uintptr_t aligned = (start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    if (aligned > start) munmap(raw, aligned - start);
+    munmap(reinterpret_cast<void*>(aligned + len), start + HUGE_PAGE_SIZE - aligned);
+
+    void* p = reinterpret_cast<void*>(aligned);
+#ifdef MADV_HUGEPAGE
+    if (mode != page_mode::standard) madvise(p, len, MADV_HUGEPAGE);
+#endif
+    return p;
+}
+
+inline void unmap_buckets(void* p, size_t bytes) {
+    size_t len = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+    munmap(p, len);
+}
+
+// Allocator for the per-bucket arrays of every engine. Large arrays are
+// mapped directly so they can be put on huge pages: random probes into a
+// table of hundreds of millions of buckets otherwise miss the TLB on almost
+// every lookup. Stateless; the backing is chosen from the size alone, so
+// deallocate() needs nothing but the element count. Small arrays honour
+// alignof(T); mappings are aligned to HUGE_PAGE_SIZE, which covers any
+// over-aligned bucket.
+template<typename T>
+struct bucket_allocator {
+    using value_type = T;
+
+    bucket_allocator() = default;
+    template<typename U>
+    bucket_allocator(const bucket_allocator<U>&) {}
+
+    T* allocate(size_t n) {
+      size_t bytes = n * sizeof(T);
+      if (bytes < HUGE_PAGE_SIZE)
+        return static_cast<T*>(::operator new(bytes, std::align_val_t{alignof(T)}));
+      return static_cast<T*>(map_buckets(bytes));
+    }
+
+    void deallocate(T* p, size_t n) {
+      size_t bytes = n * sizeof(T);
+      if (bytes < HUGE_PAGE_SIZE)
+        ::operator delete(p, std::align_val_t{alignof(T)});
+      else
+        unmap_buckets(p, bytes);
+    }
+
+    template<typename U>
+    bool operator==(const bucket_allocator<U>&) const { return true; }
+};
+
+// Allocator for the table a resize builds, derived from the current one.
+// Stateless allocators are just copied; allocators with per-table state
+// overload this (see arena_allocator.h).
+template<typename Alloc>
+Alloc next_generation(const Alloc& alloc) {
+    return alloc;
+}
+
+} // namespace cuckoo
@@ -0,0 +1,234 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+#include "bucket_allocator.h"
+#include "cuckoo_seq.h"
+#include "cuckoo_stats.h"
+#include "cuckoo_striped.h"
+#include "hashes.h"
+#include "op_gate.h"
+
+namespace cuckoo {
+
+enum class adaptive_mode { sequential, striped };
+
+// Engine that picks its layout at run time. It starts as a cuckoo_seq
+// behind one mutex, which costs a single uncontended lock per operation
+// when one thread at a time uses it. Under contention it migrates to a
+// cuckoo_striped, and back once a single thread is issuing all operations
+// again.
+//
+// Every SAMPLE_EVERY operations a thread records itself as the last one
+// seen. Every WINDOW samples the table decides: sequential mode upgrades
+// once more than UPGRADE_PERCENT of the window's operations found the mutex
+// taken, striped mode downgrades if every sample in the window came from
+// the same thread. Operations run inside an op_gate, so a migration waits
+// for the ones in flight, then moves every key into the new layout while
+// new ones retry.
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>>
+class cuckoo_adaptive {
+public:
+    using key_type = Key;
+
+    explicit cuckoo_adaptive(size_t capacity = 16, const Alloc& alloc = Alloc())
+        : alloc_(alloc),
+          seq(new cuckoo_seq<Key, Alloc>(capacity, alloc)){}
+
+    static void configure(size_t max_relocations,
+                          size_t probe_size,
+                          size_t threshold,
+                          size_t limit)
+    {
+      cuckoo_seq<Key, Alloc>::configure(max_relocations);
+      cuckoo_striped<Key, Alloc>::configure(max_relocations, probe_size, threshold, limit);
+    }
+
+    // Sampling and thresholds for the migrations.
+    static void configure_adaptation(size_t sample_every, size_t window, size_t upgrade_percent)
+    {
+      SAMPLE_EVERY = sample_every;
+      WINDOW = window;
+      UPGRADE_PERCENT = upgrade_percent;
+    }
+
+    template<std::convertible_to<Key> K>
+    bool add(K&& keyParam){
+      Key key = std::forward<K>(keyParam);
+      return run([&](auto& table){ return table.add(std::move(key)); });
+    }
+
+    bool contains(const Key& key) const{
+      return run([&](auto& table){ return table.contains(key); });
+    }
+
+    // found[i] = contains(keys[i]), see cuckoo_seq::contains_batch().
+    void contains_batch(std::span<const Key> keys, std::span<bool> found,
+                        size_t group = AMAC_GROUP) const{
+      run([&](auto& table){ table.contains_batch(keys, found, group); return true; });
+    }
+
+    bool remove(const Key& key){
+      return run([&](auto& table){ return table.remove(key); });
+    }
+
+    // Removes every key for which pred(key) is true and returns how many
+    // went. As the current engine's erase_if().
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      return run([&](auto& table){ return table.erase_if(pred); });
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
+    size_t size() const {
+      return run([&](auto& table){ return table.size(); });
+    }
+
+    size_t bucket_count() const {
+      return run([&](auto& table){ return table.bucket_count(); });
+    }
+
+    // Counters of the current engine; they start over at each migration.
+    cuckoo_stats stats() const {
+      return run([&](auto& table){ return table.stats(); });
+    }
+
+    void populate(std::vector<Key>& values){
+      for(Key& key : values){
+        add(key);
+      }
+      return;
+    }
+
+    // Bytes of the current engine, plus the gate and mutexes that pick it.
+    cuckoo_memory memory_usage() const {
+      cuckoo_memory m = run([&](auto& table){ return table.memory_usage(); });
+      m.lock_bytes += sizeof(op_gate) + 2 * sizeof(std::mutex);
+      return m;
+    }
+
+    adaptive_mode mode() const {
+      return sequential ? adaptive_mode::sequential : adaptive_mode::striped;
+    }
+
+    // Moves to the given layout now, whatever the sampling says. The table
+    // may still move back later.
+    void switch_to(adaptive_mode target){
+      migrate(target);
+    }
+
+    // Layout changes so far
+    size_t migrations() const {
+      return migrations_;
+    }
+
+private:
+    // Runs fn on the current engine inside the gate, then samples. The
+    // engines are swapped only while the gate is closed, which is why
+    // const operations may migrate too and the members they touch are
+    // mutable.
+    template<typename F>
+    auto run(F&& fn) const{
+      while(!gate.enter()) std::this_thread::yield();
+      auto result = [&]{
+        if(sequential){
+          std::unique_lock<std::mutex> lock(seq_mtx, std::try_to_lock);
+          if(!lock.owns_lock()){
+            contended++;
+            lock.lock();
+          }
+          return fn(*seq);
+        }
+        return fn(*striped);
+      }();
+      gate.leave();
+      sample();
+      return result;
+    }
+
+    void sample() const{
+      thread_local size_t ops = 0;
+      if(++ops % SAMPLE_EVERY != 0) return;
+      size_t me = std::hash<std::thread::id>()(std::this_thread::get_id());
+      if(last_thread.exchange(me) != me) switches++;
+      if(++samples % WINDOW != 0) return;
+
+      size_t c = contended.exchange(0);
+      size_t s = switches.exchange(0);
+      if(sequential && c * 100 > WINDOW * SAMPLE_EVERY * UPGRADE_PERCENT)
+        migrate(adaptive_mode::striped);
+      else if(!sequential && s == 0)
+        migrate(adaptive_mode::sequential);
+    }
+
+    // Empties the current engine into a new one of the other layout, with
+    // the gate closed. erase_if() is used to visit every key, and it may call
+    // its predicate from several threads on the task pool, so the keys are
+    // first collected under a mutex and only then added, on this thread. An
+    // add from inside the predicate could resize the new engine, and a
+    // resize waiting on the pool may run the rest of this erase_if() on the
+    // same thread, adding keys while the arrays are being split.
+    void migrate(adaptive_mode target) const{
+      std::unique_lock<std::mutex> lock(migrate_mtx);
+      if(mode() == target) return;
+      gate.close();
+      std::vector<Key> keys;
+      std::mutex keys_mtx;
+      // each key's slot is cleared as soon as the predicate returns, so the
+      // key can be moved out of it
+      auto take = [&](const Key& key){
+        std::unique_lock<std::mutex> keys_lock(keys_mtx);
+        keys.push_back(std::move(const_cast<Key&>(key)));
+        return true;
+      };
+      if(target == adaptive_mode::striped){
+        keys.reserve(seq->size());
+        seq->erase_if(take);
+        striped.reset(new cuckoo_striped<Key, Alloc>(seq->bucket_count(), alloc_));
+        seq.reset();
+        for(Key& key : keys) striped->add(std::move(key));
+        sequential = false;
+      }
+      else{
+        keys.reserve(striped->size());
+        striped->erase_if(take);
+        seq.reset(new cuckoo_seq<Key, Alloc>(striped->bucket_count(), alloc_));
+        striped.reset();
+        for(Key& key : keys) seq->add(std::move(key));
+        sequential = true;
+      }
+      migrations_++;
+      gate.open();
+    }
+
+    Alloc alloc_;
+    // exactly one of these is set, the one sequential names
+    mutable std::unique_ptr<cuckoo_seq<Key, Alloc>> seq;
+    mutable std::unique_ptr<cuckoo_striped<Key, Alloc>> striped;
+    mutable std::atomic<bool> sequential{true};
+    mutable std::mutex seq_mtx;
+
+    mutable op_gate gate;
+    mutable std::mutex migrate_mtx;
+    mutable std::atomic<size_t> last_thread{0};
+    mutable std::atomic<size_t> switches{0};
+    mutable std::atomic<size_t> samples{0};
+    mutable std::atomic<size_t> contended{0};
+    mutable std::atomic<size_t> migrations_{0};
+
+    inline static size_t SAMPLE_EVERY = 256;
+    inline static size_t WINDOW = 64;
+    inline static size_t UPGRADE_PERCENT = 1;
+};
+
+} // namespace cuckoo
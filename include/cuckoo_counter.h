@@ -0,0 +1,494 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include "bucket_allocator.h"
+#include "cuckoo_stats.h"
+#include "hashes.h"
+#include "task_pool.h"
+
+namespace cuckoo {
+
+// Counting multiset on the cuckoo_striped locking scheme: a fixed array of
+// stripe locks per table, both stripes of a key taken in table order, and
+// relocations serialized on resize_mtx. Each bucket holds up to PROBE_SIZE
+// (key, count) entries in place; an insert past THRESHOLD starts a
+// relocation as in cuckoo_striped::add().
+//
+// Keys of 32 bits or less are packed with their count into one 64-bit word,
+// so a key that is already present is counted with a compare-and-swap on
+// its word and no lock. The CAS fails if the slot was given to another key
+// in between. A key that is not found that way (absent, being relocated, or
+// about to drop to zero) goes through the locked path, which is
+// authoritative for presence. Resize waits for lock-free readers to leave
+// before it replaces the arrays. Packed counts are limited to 2^32 - 1.
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>>
+class cuckoo_counter {
+    static constexpr bool PACKED = std::integral<Key> && sizeof(Key) <= 4;
+
+    struct entry {
+      std::optional<Key> key;
+      uint64_t count = 0;
+    };
+    using slot = std::conditional_t<PACKED, std::atomic<uint64_t>, entry>;
+    using bucket_array = std::vector<slot, typename std::allocator_traits<Alloc>::template rebind_alloc<slot>>;
+
+public:
+    static constexpr uint64_t MAX_COUNT = PACKED ? UINT32_MAX : UINT64_MAX;
+
+    explicit cuckoo_counter(size_t capacity = 16, const Alloc& alloc = Alloc())
+        : capacity(next_power_of_two(capacity)),
+          size_(0),
+          width(PROBE_SIZE),
+          table1(this->capacity * width, alloc),
+          table2(this->capacity * width, alloc),
+          mtx1(this->capacity),
+          mtx2(this->capacity),
+          readers(new std::atomic<uint32_t>[this->capacity]()){}
+
+    static void configure(size_t max_relocations,
+                          size_t probe_size,
+                          size_t threshold,
+                          size_t limit)
+    {
+      MAX_RELOCATIONS = max_relocations;
+      PROBE_SIZE = probe_size;
+      THRESHOLD = threshold;
+      LIMIT = limit;
+    }
+
+    // Adds delta to key's count, inserting it if absent, and returns the new
+    // count. Throws std::overflow_error past MAX_COUNT.
+    uint64_t increment(const Key& key, uint64_t delta = 1){
+      if(delta == 0) return get(key);
+      // checked first: a delta past MAX_COUNT would carry into a packed key
+      if(delta > MAX_COUNT) throw std::overflow_error("cuckoo_counter: count overflow");
+      size_t h1 = hash1(key);
+      size_t h2 = hash2(key);
+      uint64_t result = 0;
+      if constexpr (PACKED) {
+        bool done = lock_free(h1, h2, key, [&](uint64_t w, uint64_t& next){
+          if(delta > MAX_COUNT - count_of(w)) return false;
+          next = w + delta;
+          result = count_of(next);
+          return true;
+        });
+        if(done) return result;
+      }
+
+      std::unique_lock<std::recursive_mutex> lock1(mtx1[h1 & (mtx1.size() - 1)]);
+      std::unique_lock<std::recursive_mutex> lock2(mtx2[h2 & (mtx2.size() - 1)]);
+
+      size_t b1 = h1 & (capacity - 1);
+      size_t b2 = h2 & (capacity - 1);
+      slot* s = find(key, b1, b2);
+      if(s) return add_count(*s, delta);
+
+      int i = -1;
+      size_t h = 0;
+      bool mustResize = false;
+      size_t used1 = used(table1, b1);
+      size_t used2 = used(table2, b2);
+      if(used1 < THRESHOLD){
+        fill(free_slot(table1, b1), key, delta);
+        size_++;
+        stats_.record_insert(0);
+        return delta;
+      }
+      else if(used2 < THRESHOLD){
+        fill(free_slot(table2, b2), key, delta);
+        size_++;
+        stats_.record_insert(0);
+        return delta;
+      }
+      else if(used1 < width){
+        fill(free_slot(table1, b1), key, delta);
+        i = 0;
+        h = b1;
+      }
+      else if(used2 < width){
+        fill(free_slot(table2, b2), key, delta);
+        i = 1;
+        h = b2;
+      }
+      else{
+        mustResize = true;
+      }
+      lock1.unlock();
+      lock2.unlock();
+
+      if(mustResize){
+        resize();
+        return increment(key, delta);
+      }
+      // key is in the table from here on, whether or not relocate succeeds
+      size_++;
+      if(!relocate(i, h)){
+        stats_.relocation_failures.add();
+        resize();
+      }
+      return delta;
+    }
+
+    // key's count, 0 if absent.
+    uint64_t get(const Key& key) const{
+      size_t h1 = hash1(key);
+      size_t h2 = hash2(key);
+      uint64_t result = 0;
+      if constexpr (PACKED) {
+        bool done = lock_free(h1, h2, key, [&](uint64_t w, uint64_t&){
+          result = count_of(w);
+          return false; // nothing to write
+        });
+        if(done || result != 0) return result;
+      }
+
+      std::unique_lock<std::recursive_mutex> lock1(mtx1[h1 & (mtx1.size() - 1)]);
+      std::unique_lock<std::recursive_mutex> lock2(mtx2[h2 & (mtx2.size() - 1)]);
+      const slot* s = const_cast<cuckoo_counter*>(this)->find(key, h1 & (capacity - 1), h2 & (capacity - 1));
+      return s ? count_of(*s) : 0;
+    }
+
+    // Takes one off key's count and erases it when the count reaches zero.
+    // Returns the new count, 0 if the key was absent.
+    uint64_t decrement_and_erase_if_zero(const Key& key){
+      size_t h1 = hash1(key);
+      size_t h2 = hash2(key);
+      uint64_t result = 0;
+      if constexpr (PACKED) {
+        // the last decrement erases, which needs the locks
+        bool done = lock_free(h1, h2, key, [&](uint64_t w, uint64_t& next){
+          if(count_of(w) <= 1) return false;
+          next = w - 1;
+          result = count_of(next);
+          return true;
+        });
+        if(done) return result;
+      }
+
+      std::unique_lock<std::recursive_mutex> lock1(mtx1[h1 & (mtx1.size() - 1)]);
+      std::unique_lock<std::recursive_mutex> lock2(mtx2[h2 & (mtx2.size() - 1)]);
+      slot* s = find(key, h1 & (capacity - 1), h2 & (capacity - 1));
+      if(!s) return 0;
+      result = take_one(*s);
+      if(result == 0) size_--;
+      return result;
+    }
+
+    // Number of distinct keys.
+    size_t size() const {
+      return size_;
+    }
+
+    size_t bucket_count() const {
+      return capacity;
+    }
+
+    cuckoo_stats stats() const {
+      return stats_.snapshot();
+    }
+
+    // Bytes allocated for the table; entries sit in the bucket arrays, so
+    // there is no overflow.
+    cuckoo_memory memory_usage() const {
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      cuckoo_memory m;
+      m.table_bytes = (table1.capacity() + table2.capacity()) * sizeof(slot);
+      m.lock_bytes = (mtx1.size() + mtx2.size() + 1) * sizeof(std::recursive_mutex)
+                   + mtx1.size() * sizeof(std::atomic<uint32_t>);
+      return m;
+    }
+
+private:
+    // ---- slot access; packed words are read and written atomically since
+    // lock-free updates run alongside the locked paths ----
+
+    static uint64_t pack(const Key& key, uint64_t count){
+      return (uint64_t(static_cast<uint32_t>(key)) << 32) | count;
+    }
+
+    static uint64_t count_of(uint64_t w){
+      return w & UINT32_MAX;
+    }
+
+    static bool word_holds(uint64_t w, const Key& key){
+      return w != 0 && uint32_t(w >> 32) == static_cast<uint32_t>(key);
+    }
+
+    static bool occupied(const slot& s){
+      if constexpr (PACKED) return s.load(std::memory_order_acquire) != 0;
+      else return s.key.has_value();
+    }
+
+    static bool holds(const slot& s, const Key& key){
+      if constexpr (PACKED) return word_holds(s.load(std::memory_order_acquire), key);
+      else return s.key == key;
+    }
+
+    static uint64_t count_of(const slot& s){
+      if constexpr (PACKED) return count_of(s.load(std::memory_order_acquire));
+      else return s.count;
+    }
+
+    static Key key_of(const slot& s){
+      if constexpr (PACKED) return static_cast<Key>(uint32_t(s.load(std::memory_order_acquire) >> 32));
+      else return *s.key;
+    }
+
+    static void fill(slot& s, const Key& key, uint64_t count){
+      if constexpr (PACKED) s.store(pack(key, count), std::memory_order_release);
+      else { s.key = key; s.count = count; }
+    }
+
+    static uint64_t add_count(slot& s, uint64_t delta){
+      if constexpr (PACKED) {
+        uint64_t w = s.load(std::memory_order_acquire);
+        do {
+          if(delta > MAX_COUNT - count_of(w)) throw std::overflow_error("cuckoo_counter: count overflow");
+        } while(!s.compare_exchange_weak(w, w + delta, std::memory_order_acq_rel));
+        return count_of(w + delta);
+      }
+      else {
+        if(delta > MAX_COUNT - s.count) throw std::overflow_error("cuckoo_counter: count overflow");
+        return s.count += delta;
+      }
+    }
+
+    // Decrements, emptying the slot at zero. Returns the new count.
+    static uint64_t take_one(slot& s){
+      if constexpr (PACKED) {
+        uint64_t w = s.load(std::memory_order_acquire);
+        uint64_t next;
+        do {
+          next = count_of(w) <= 1 ? 0 : w - 1;
+        } while(!s.compare_exchange_weak(w, next, std::memory_order_acq_rel));
+        return count_of(next);
+      }
+      else {
+        if(--s.count == 0) s.key.reset();
+        return s.count;
+      }
+    }
+
+    // Moves the entry in `from` to the empty slot `to`. For packed slots the
+    // word is taken with an exchange, so an increment that lands first is
+    // carried along and one that comes after finds nothing and falls back
+    // to the locks, which the caller holds.
+    static void move_slot(slot& from, slot& to){
+      if constexpr (PACKED) to.store(from.exchange(0, std::memory_order_acq_rel), std::memory_order_release);
+      else { to = std::move(from); from.key.reset(); from.count = 0; }
+    }
+
+    slot* find(const Key& key, size_t b1, size_t b2){
+      for(size_t k = 0; k < width; k++)
+        if(holds(table1[b1 * width + k], key)) return &table1[b1 * width + k];
+      for(size_t k = 0; k < width; k++)
+        if(holds(table2[b2 * width + k], key)) return &table2[b2 * width + k];
+      return nullptr;
+    }
+
+    size_t used(const bucket_array& table, size_t b) const{
+      size_t n = 0;
+      for(size_t k = 0; k < width; k++) n += occupied(table[b * width + k]);
+      return n;
+    }
+
+    slot& free_slot(bucket_array& table, size_t b){
+      for(size_t k = 0; k < width; k++)
+        if(!occupied(table[b * width + k])) return table[b * width + k];
+      throw std::logic_error("cuckoo_counter: bucket full");
+    }
+
+    // Finds key's word in either bucket without locking and offers it to
+    // step(w, next). If step returns true the word is replaced by next with
+    // a CAS, retried from a fresh read if the CAS loses. Returns true once a
+    // CAS succeeds; false sends the caller down the locked path. The stripe
+    // reader count keeps resize() from freeing the arrays under us.
+    template<typename Step>
+    bool lock_free(size_t h1, size_t h2, const Key& key, Step step) const{
+      std::atomic<uint32_t>& r = readers[h1 & (mtx1.size() - 1)];
+      r.fetch_add(1);
+      bool done = false;
+      if(!resizing.load()){
+        size_t cap = capacity;
+        done = lock_free_bucket(table1, (h1 & (cap - 1)) * width, key, step)
+            || lock_free_bucket(table2, (h2 & (cap - 1)) * width, key, step);
+      }
+      r.fetch_sub(1, std::memory_order_release);
+      return done;
+    }
+
+    template<typename Step>
+    bool lock_free_bucket(const bucket_array& table, size_t first, const Key& key, Step& step) const{
+      for(size_t k = first; k < first + width; k++){
+        slot& s = const_cast<slot&>(table[k]);
+        uint64_t w = s.load(std::memory_order_acquire);
+        while(word_holds(w, key)){
+          uint64_t next;
+          if(!step(w, next)) return false;
+          if(s.compare_exchange_weak(w, next, std::memory_order_acq_rel)) return true;
+        }
+      }
+      return false;
+    }
+
+    void resize(){
+
+      needResize = true;
+      stat_timer wait;
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      stats_.resize_wait_ns.add(wait.elapsed_ns());
+      if(!needResize) return;
+
+      stat_timer timer;
+      std::vector<std::unique_lock<std::recursive_mutex>> locks;
+      for(std::recursive_mutex& mtx : mtx1){
+        locks.push_back(std::unique_lock<std::recursive_mutex>(mtx));
+      }
+      // every locked path is shut out; wait for the lock-free ones to leave
+      resizing = true;
+      for(size_t s = 0; s < mtx1.size(); s++){
+        while(readers[s].load() != 0) std::this_thread::yield();
+      }
+
+      size_t old_capacity = capacity;
+      capacity = old_capacity * 2;
+      bucket_array old_table1(capacity * width, table1.get_allocator());
+      bucket_array old_table2(capacity * width, table2.get_allocator());
+      std::swap(old_table1, table1);
+      std::swap(old_table2, table2);
+
+      // Keys of old bucket b land in b or b + old_capacity, and each new
+      // bucket is fed by one old bucket only, so they always fit.
+      parallel_for(0, old_capacity, SPLIT_CHUNK, [&](size_t begin, size_t end){
+        for(size_t b = begin; b < end; b++){
+          for(size_t k = 0; k < width; k++){
+            slot& s1 = old_table1[b * width + k];
+            if(occupied(s1)) move_slot(s1, free_slot(table1, b | (hash1(key_of(s1)) & old_capacity)));
+            slot& s2 = old_table2[b * width + k];
+            if(occupied(s2)) move_slot(s2, free_slot(table2, b | (hash2(key_of(s2)) & old_capacity)));
+          }
+        }
+      });
+      resizing = false;
+      needResize = false;
+      stats_.resizes.add();
+      stats_.resize_ns.add(timer.elapsed_ns());
+    }
+
+    // cuckoo_striped::relocate() over fixed-width buckets. The oldest entry
+    // of an over-threshold bucket is moved to its other table until a bucket
+    // below THRESHOLD takes it.
+    bool relocate(int i, size_t hi){
+      stat_timer wait;
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      stats_.resize_wait_ns.add(wait.elapsed_ns());
+      size_t path = 0;
+      int j = 1 - i;
+      for(size_t round = 0; round < LIMIT; round++){
+        bucket_array& iTable = (i == 0) ? table1 : table2;
+        bucket_array& jTable = (j == 0) ? table1 : table2;
+        std::optional<Key> y = first_key(i, hi);
+        if(!y){
+          stats_.record_insert(path);
+          return true;
+        }
+
+        size_t hy1 = hash1(*y);
+        size_t hy2 = hash2(*y);
+
+        std::unique_lock<std::recursive_mutex> lock1(mtx1[hy1 & (mtx1.size() - 1)]);
+        std::unique_lock<std::recursive_mutex> lock2(mtx2[hy2 & (mtx2.size() - 1)]);
+
+        size_t hj = (j == 0) ? (hy1 & (capacity - 1)) : (hy2 & (capacity - 1));
+        slot* ys = nullptr;
+        for(size_t k = 0; k < width && !ys; k++)
+          if(holds(iTable[hi * width + k], *y)) ys = &iTable[hi * width + k];
+
+        if(ys){
+          size_t jUsed = used(jTable, hj);
+          if(jUsed >= width) return false;
+          move_slot(*ys, free_slot(jTable, hj));
+          path++;
+          if(jUsed < THRESHOLD){
+            stats_.record_insert(path);
+            return true;
+          }
+          i = 1 - i;
+          hi = hj;
+          j = 1 - j;
+        }
+        else if(used(iTable, hi) >= THRESHOLD){
+          continue;
+        }
+        else{
+          stats_.record_insert(path);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Some key in bucket hi of table i, read under that bucket's stripe for
+    // keys that cannot be read atomically.
+    std::optional<Key> first_key(int i, size_t hi){
+      bucket_array& table = (i == 0) ? table1 : table2;
+      std::vector<std::recursive_mutex>& mtx = (i == 0) ? mtx1 : mtx2;
+      std::unique_lock<std::recursive_mutex> lock(mtx[hi & (mtx.size() - 1)], std::defer_lock);
+      if constexpr (!PACKED) lock.lock();
+      for(size_t k = 0; k < width; k++){
+        if constexpr (PACKED) {
+          uint64_t w = table[hi * width + k].load(std::memory_order_acquire);
+          if(w != 0) return static_cast<Key>(uint32_t(w >> 32));
+        }
+        else if(table[hi * width + k].key) return table[hi * width + k].key;
+      }
+      return std::nullopt;
+    }
+
+    size_t next_power_of_two(size_t n){
+      if (n == 0) return 1;
+      // If already a power of two, return n
+      if ((n & (n - 1)) == 0) return n;
+      // Otherwise, round up
+      size_t power = 1;
+      while (power < n) power <<= 1;
+      return power;
+    }
+
+    std::atomic<size_t> capacity; // must be power of two
+    std::atomic<size_t> size_;
+    const size_t width; // entries per bucket, PROBE_SIZE at construction
+    bucket_array table1;
+    bucket_array table2;
+
+    mutable std::vector<std::recursive_mutex> mtx1;
+    mutable std::vector<std::recursive_mutex> mtx2;
+    std::unique_ptr<std::atomic<uint32_t>[]> readers; // lock-free paths, per stripe of mtx1
+    mutable std::recursive_mutex resize_mtx;
+    std::atomic<bool> needResize = false;
+    std::atomic<bool> resizing = false;
+
+    myhash::StdHash1<Key> hash1;
+    myhash::StdHash2<Key> hash2;
+
+    mutable stats_block stats_;
+
+    inline static size_t MAX_RELOCATIONS = 16;
+    inline static size_t PROBE_SIZE = 4;
+    inline static size_t THRESHOLD = 2;
+    inline static size_t LIMIT = 10;
+
+    // Smallest range of old buckets worth handing to another thread in resize
+    inline static constexpr size_t SPLIT_CHUNK = 4096;
+};
+
+} // namespace cuckoo
@@ -0,0 +1,304 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <concepts>
+#include <cstdint>
+#include <mutex>
+#include <random>
+#include <utility>
+#include <vector>
+#include "cuckoo_stats.h"
+#include "hashes.h"
+
+namespace cuckoo {
+
+// Concurrent cuckoo filter: a set of short fingerprints in buckets of SLOTS,
+// answering "definitely absent" or "maybe present". Partial-key cuckoo
+// hashing puts a key's fingerprint in bucket i1 = hash(key) or
+// i2 = i1 ^ hash(fingerprint), so either bucket can be found from the other
+// and the fingerprint alone, and kicked fingerprints move without their key.
+//
+// Locking follows cuckoo_striped: a fixed array of stripe locks, both
+// stripes of a bucket pair taken (here in index order), and displacements
+// serialized on kick_mtx. The fingerprint being displaced is kept in the
+// victim slot, which lookups check too, so a key that was added never reads
+// as absent while its fingerprint is in flight. If MAX_KICKS displacements
+// find no room the last fingerprint stays in the victim slot, and further
+// adds that need a displacement fail until a remove frees it.
+//
+// The filter does not grow: fingerprints cannot be rehashed without their
+// keys. Size it with the expected number of keys.
+template<myhash::Hashable Key, std::unsigned_integral Fingerprint = uint16_t>
+class cuckoo_filter {
+    static_assert(sizeof(Fingerprint) <= 2, "the victim slot packs a fingerprint into 16 bits");
+
+public:
+    explicit cuckoo_filter(size_t expected_keys = 1024)
+        : buckets(buckets_for(expected_keys)),
+          size_(0),
+          slots(buckets * SLOTS, 0),
+          mtx(std::min(buckets, STRIPES)){}
+
+    static void configure(size_t max_kicks)
+    {
+      MAX_KICKS = max_kicks;
+    }
+
+    // Records key. Adding a key twice records it twice, and it then takes
+    // two removes. Returns false, with nothing recorded, if the filter is
+    // too full.
+    bool add(const Key& key){
+      auto [i1, i2, fp] = locate(key);
+      {
+        pair_lock lock(*this, i1, i2);
+        if(place(i1, fp) || place(i2, fp)){
+          size_++;
+          return true;
+        }
+      }
+
+      std::unique_lock<std::recursive_mutex> kick_lock(kick_mtx);
+      {
+        pair_lock lock(*this, i1, i2);
+        if(place(i1, fp) || place(i2, fp)){
+          size_++;
+          return true;
+        }
+        if(victim.load() != 0) return false;
+        victim = pack(fp, i1);
+      }
+      size_++;
+      kick();
+      return true;
+    }
+
+    // False means key was never added, or has been removed as often as it
+    // was added. True may be a false positive.
+    bool contains(const Key& key) const{
+      auto [i1, i2, fp] = locate(key);
+      pair_lock lock(*this, i1, i2);
+      return find(i1, fp) != NONE || find(i2, fp) != NONE || victim_is(i1, i2, fp);
+    }
+
+    // Removes one record of key. Only call it for a key that was added:
+    // otherwise it may remove the fingerprint of another key.
+    bool remove(const Key& key){
+      auto [i1, i2, fp] = locate(key);
+      pair_lock lock(*this, i1, i2);
+      for(size_t b : {i1, i2}){
+        size_t s = find(b, fp);
+        if(s != NONE){
+          slots[b * SLOTS + s] = 0;
+          size_--;
+          return true;
+        }
+      }
+      if(victim_is(i1, i2, fp)){
+        victim = 0;
+        size_--;
+        return true;
+      }
+      return false;
+    }
+
+    size_t size() const {
+      return size_;
+    }
+
+    size_t bucket_count() const {
+      return buckets;
+    }
+
+    // Bytes allocated: the fingerprint array and the stripe locks.
+    cuckoo_memory memory_usage() const {
+      cuckoo_memory m;
+      m.table_bytes = slots.capacity() * sizeof(Fingerprint);
+      m.lock_bytes = (mtx.size() + 1) * sizeof(std::recursive_mutex);
+      return m;
+    }
+
+    // Fingerprints stored per bucket
+    static constexpr size_t SLOTS = 4;
+
+private:
+    // Both stripes of a bucket pair, the lower index first so that threads
+    // locking overlapping pairs cannot deadlock.
+    struct pair_lock {
+      std::unique_lock<std::recursive_mutex> first;
+      std::unique_lock<std::recursive_mutex> second;
+
+      pair_lock(const cuckoo_filter& f, size_t b1, size_t b2){
+        size_t s1 = b1 & (f.mtx.size() - 1);
+        size_t s2 = b2 & (f.mtx.size() - 1);
+        if(s1 > s2) std::swap(s1, s2);
+        first = std::unique_lock<std::recursive_mutex>(f.mtx[s1]);
+        if(s2 != s1) second = std::unique_lock<std::recursive_mutex>(f.mtx[s2]);
+      }
+    };
+
+    struct location {
+      size_t i1;
+      size_t i2;
+      Fingerprint fp;
+    };
+
+    location locate(const Key& key) const{
+      size_t h = hash(key);
+      // the bucket comes from the low bits, the fingerprint from the high
+      // ones; 0 marks an empty slot
+      Fingerprint fp = static_cast<Fingerprint>(h >> (64 - FP_BITS));
+      if(fp == 0) fp = 1;
+      size_t i1 = h & (buckets - 1);
+      return {i1, alt_bucket(i1, fp), fp};
+    }
+
+    size_t alt_bucket(size_t b, Fingerprint fp) const{
+      return (b ^ myhash::mix64(fp)) & (buckets - 1);
+    }
+
+    size_t find(size_t b, Fingerprint fp) const{
+      for(size_t s = 0; s < SLOTS; s++){
+        if(slots[b * SLOTS + s] == fp) return s;
+      }
+      return NONE;
+    }
+
+    bool place(size_t b, Fingerprint fp){
+      size_t s = find(b, 0);
+      if(s == NONE) return false;
+      slots[b * SLOTS + s] = fp;
+      return true;
+    }
+
+    // Moves the victim to its other bucket, evicting a random fingerprint
+    // there into the victim slot when it is full, until one fits. Each step
+    // holds the stripes of the victim's pair, which are the ones a lookup
+    // for it takes, so it is never missing from both bucket and victim slot.
+    void kick(){
+      for(size_t k = 0; k < MAX_KICKS; k++){
+        uint64_t v = victim.load();
+        if(v == 0) return; // removed meanwhile
+        Fingerprint fp = static_cast<Fingerprint>(v >> 48);
+        size_t b = alt_bucket(v & BUCKET_MASK, fp);
+        pair_lock lock(*this, v & BUCKET_MASK, b);
+        if(victim.load() != v) return;
+        if(place(b, fp)){
+          victim = 0;
+          return;
+        }
+        Fingerprint& slot = slots[b * SLOTS + rng() % SLOTS];
+        victim = pack(slot, b);
+        slot = fp;
+      }
+    }
+
+    bool victim_is(size_t i1, size_t i2, Fingerprint fp) const{
+      uint64_t v = victim.load();
+      return v != 0 && static_cast<Fingerprint>(v >> 48) == fp
+          && ((v & BUCKET_MASK) == i1 || (v & BUCKET_MASK) == i2);
+    }
+
+    static uint64_t pack(Fingerprint fp, size_t b){
+      return (static_cast<uint64_t>(fp) << 48) | b;
+    }
+
+    static size_t buckets_for(size_t expected_keys){
+      // cuckoo filters with 4-slot buckets fill to about 95% before
+      // displacements start failing; leave some slack below that
+      size_t n = std::max<size_t>(1, (expected_keys * 10 / 9 + SLOTS - 1) / SLOTS);
+      size_t power = 1;
+      while (power < n) power <<= 1;
+      return power;
+    }
+
+    size_t buckets; // must be power of two
+    std::atomic<size_t> size_;
+    std::vector<Fingerprint> slots;
+    std::atomic<uint64_t> victim{0}; // fingerprint << 48 | bucket, 0 if empty
+
+    mutable std::vector<std::recursive_mutex> mtx;
+    std::recursive_mutex kick_mtx;
+    std::minstd_rand rng; // guarded by kick_mtx
+
+    myhash::StdHash1<Key> hash;
+
+    inline static size_t MAX_KICKS = 500;
+
+    static constexpr size_t FP_BITS = 8 * sizeof(Fingerprint);
+    static constexpr size_t NONE = SLOTS;
+    static constexpr uint64_t BUCKET_MASK = (uint64_t(1) << 48) - 1;
+    // Most stripe locks; one per bucket below that
+    inline static constexpr size_t STRIPES = 4096;
+};
+
+// A set engine with a cuckoo_filter in front of it, so that most lookups of
+// absent keys are answered by the filter. Table is any engine (cuckoo_seq,
+// cuckoo_striped, ...); its constructor arguments follow expected_keys.
+//
+// A key's fingerprint goes in before the key does and comes out after it is
+// gone, so the filter always holds one for every key in the table. If the
+// filter fills up, lookups bypass it from then on.
+template<typename Table, std::unsigned_integral Fingerprint = uint16_t>
+class filtered_set {
+public:
+    using key_type = typename Table::key_type;
+
+    template<typename... Args>
+    explicit filtered_set(size_t expected_keys, Args&&... args)
+        : filter_(expected_keys),
+          table_(std::forward<Args>(args)...){}
+
+    bool add(const key_type& key){
+      bool filtered = !bypass.load() && filter_.add(key);
+      if(!filtered) bypass = true;
+      if(table_.add(key)) return true;
+      // already present, and so already in the filter
+      if(filtered) filter_.remove(key);
+      return false;
+    }
+
+    bool contains(const key_type& key) const{
+      if(!bypass.load() && !filter_.contains(key)) return false;
+      return table_.contains(key);
+    }
+
+    bool remove(const key_type& key){
+      if(!table_.remove(key)) return false;
+      // once bypassed the filter may lack key, and removing it could take
+      // another key's fingerprint
+      if(!bypass.load()) filter_.remove(key);
+      return true;
+    }
+
+    size_t size() const {
+      return table_.size();
+    }
+
+    // The table's bytes plus the filter's
+    cuckoo_memory memory_usage() const {
+      cuckoo_memory m = table_.memory_usage();
+      m += filter_.memory_usage();
+      return m;
+    }
+
+    // False once the filter filled up and lookups go straight to the table
+    bool filtering() const {
+      return !bypass.load();
+    }
+
+    void populate(std::vector<key_type>& values){
+      for(key_type& key : values){
+        add(key);
+      }
+    }
+
+    const cuckoo_filter<key_type, Fingerprint>& filter() const { return filter_; }
+    const Table& table() const { return table_; }
+
+private:
+    cuckoo_filter<key_type, Fingerprint> filter_;
+    mutable Table table_; // cuckoo_refinable::contains() is not const
+    std::atomic<bool> bypass{false};
+};
+
+} // namespace cuckoo
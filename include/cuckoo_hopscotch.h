@@ -0,0 +1,389 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+#include "bucket_allocator.h"
+#include "cuckoo_stats.h"
+#include "hashes.h"
+#include "slot_traits.h"
+
+namespace cuckoo {
+
+// Concurrent hopscotch hash set, for comparison with the cuckoo engines.
+// Every key lives within NEIGHBORHOOD buckets of its home bucket, hash1 &
+// (capacity - 1), and the home's hop bitmap has a bit set for each bucket of
+// the neighborhood holding one of its keys. A lookup reads the bitmap and
+// only the slots it names. With 8-byte buckets (4-byte keys in empty_key
+// slots) the default neighborhood is 64 bytes, so a lookup touches at most
+// two cache lines.
+//
+// An add takes the first empty bucket within ADD_RANGE of the home and, while
+// it is outside the neighborhood, hops it closer: a key between it and the
+// home that may legally move there does, and its old bucket becomes the
+// empty one. If no empty bucket is found, or none can be brought close
+// enough, the table doubles.
+//
+// Buckets are grouped in segments of SEGMENT_BUCKETS, and segment s is
+// guarded by lock s & (LOCKS - 1). An operation locks every segment its
+// buckets fall in, in lock order: lookups and removes the home's
+// neighborhood (one or two segments), adds the neighborhood first and the
+// whole add range only if the neighborhood is full. The lock array never
+// changes; resize takes all of it, so an operation that finds the capacity
+// changed once it holds its locks starts over. The table has NEIGHBORHOOD - 1
+// extra buckets past the last home, so neighborhoods do not wrap.
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>,
+         typename Slots = optional_slots<Key>>
+class cuckoo_hopscotch {
+    using slot_type = typename Slots::slot_type;
+
+    struct bucket {
+      uint32_t hop = 0; // bit d: bucket home + d holds one of this home's keys
+      slot_type slot = Slots::empty();
+    };
+    using bucket_array = std::vector<bucket, typename std::allocator_traits<Alloc>::template rebind_alloc<bucket>>;
+
+public:
+    using key_type = Key;
+
+    static constexpr size_t MAX_NEIGHBORHOOD = 32; // bits in a hop bitmap
+
+    explicit cuckoo_hopscotch(size_t capacity = 16, const Alloc& alloc = Alloc())
+        : capacity(next_power_of_two(capacity)),
+          size_(0),
+          neighborhood_(NEIGHBORHOOD),
+          add_range(std::max(ADD_RANGE, NEIGHBORHOOD)),
+          buckets(this->capacity + neighborhood_ - 1, alloc),
+          locks(LOCKS){}
+
+    // neighborhood is capped at MAX_NEIGHBORHOOD, and the add range is at
+    // least the neighborhood. Both apply to tables constructed afterwards.
+    static void configure(size_t neighborhood, size_t add_range)
+    {
+      NEIGHBORHOOD = std::clamp<size_t>(neighborhood, 1, MAX_NEIGHBORHOOD);
+      ADD_RANGE = add_range;
+    }
+
+    template<std::convertible_to<Key> K>
+    bool add(K&& keyParam){
+      Key key = std::forward<K>(keyParam);
+      if(Slots::reserved(key)){
+        throw std::invalid_argument("cuckoo_hopscotch: key is reserved for empty slots");
+      }
+      size_t h = hash1(key);
+      while(true){
+        size_t cap = capacity;
+        size_t home = h & (cap - 1);
+        {
+          segment_lock lock(*this, home, home + neighborhood_);
+          if(cap != capacity){ stats_.lock_retries.add(); continue; }
+          if(find(key, home) != NONE) return false;
+          for(size_t d = 0; d < neighborhood_; d++){
+            if(Slots::is_empty(buckets[home + d].slot)){
+              place(std::move(key), home, home + d);
+              stats_.record_insert(0);
+              return true;
+            }
+          }
+        }
+
+        // the neighborhood is full: look further out, holding the whole range.
+        // The range is bounded by cap, not buckets.size(): the array may only
+        // be read under a lock, and claim() clamps to it once one is held.
+        {
+          segment_lock lock(*this, home, std::min(home + add_range, cap + neighborhood_ - 1));
+          if(cap != capacity){ stats_.lock_retries.add(); continue; }
+          if(find(key, home) != NONE) return false;
+          size_t path = 0;
+          size_t free = claim(buckets, home, path);
+          if(free != NONE){
+            place(std::move(key), home, free);
+            stats_.record_insert(path);
+            return true;
+          }
+        }
+        stats_.relocation_failures.add();
+        resize(cap);
+      }
+    }
+
+    bool contains(const Key& key) const{
+      if(Slots::reserved(key)) return false;
+      size_t h = hash1(key);
+      while(true){
+        size_t cap = capacity;
+        size_t home = h & (cap - 1);
+        segment_lock lock(*this, home, home + neighborhood_);
+        if(cap != capacity) continue;
+        return find(key, home) != NONE;
+      }
+    }
+
+    bool remove(const Key& key){
+      if(Slots::reserved(key)) return false;
+      size_t h = hash1(key);
+      while(true){
+        size_t cap = capacity;
+        size_t home = h & (cap - 1);
+        segment_lock lock(*this, home, home + neighborhood_);
+        if(cap != capacity){ stats_.lock_retries.add(); continue; }
+        size_t b = find(key, home);
+        if(b == NONE) return false;
+        buckets[b].slot = Slots::empty();
+        buckets[home].hop &= ~(uint32_t(1) << (b - home));
+        size_--;
+        return true;
+      }
+    }
+
+    // Removes every key for which pred(key) is true and returns how many
+    // went. Clearing a key updates its home's bitmap, which may sit in the
+    // range of another thread, so the scan runs on this thread with every
+    // lock held; pred is called from this thread only.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      std::unique_lock<std::mutex> resize_lock(resize_mtx);
+      segment_lock lock(*this, 0, buckets.size());
+      size_t erased = 0;
+      for(size_t b = 0; b < buckets.size(); b++){
+        slot_type& s = buckets[b].slot;
+        if(Slots::is_empty(s) || !pred(Slots::key(s))) continue;
+        size_t home = hash1(Slots::key(s)) & (capacity - 1);
+        buckets[home].hop &= ~(uint32_t(1) << (b - home));
+        s = Slots::empty();
+        erased++;
+      }
+      size_ -= erased;
+      return erased;
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
+    size_t size() const {
+      return size_;
+    }
+
+    // Home buckets; each holds at most one key.
+    size_t bucket_count() const {
+      return capacity;
+    }
+
+    size_t neighborhood() const {
+      return neighborhood_;
+    }
+
+    cuckoo_stats stats() const {
+      return stats_.snapshot();
+    }
+
+    // Bytes allocated for the table: the bucket array, tail included, and
+    // the segment locks.
+    cuckoo_memory memory_usage() const {
+      std::unique_lock<std::mutex> resize_lock(resize_mtx);
+      cuckoo_memory m;
+      m.table_bytes = buckets.capacity() * sizeof(bucket);
+      m.lock_bytes = (locks.size() + 1) * sizeof(std::mutex);
+      return m;
+    }
+
+    void populate(std::vector<Key>& values){
+      for(Key& key : values){
+        add(key);
+      }
+      return;
+    }
+
+private:
+    static constexpr size_t NONE = SIZE_MAX;
+
+    // Locks the segments of buckets [first, last) in lock order; all LOCKS
+    // of them if the range has that many segments.
+    class segment_lock{
+    public:
+      segment_lock(const cuckoo_hopscotch& p, size_t first, size_t last) : p(p){
+        size_t s_first = first / SEGMENT_BUCKETS;
+        size_t s_last = (last - 1) / SEGMENT_BUCKETS;
+        if(s_last - s_first + 1 >= LOCKS){
+          lo = 0;
+          hi = LOCKS - 1;
+        }
+        else{
+          lo = s_first & (LOCKS - 1);
+          hi = s_last & (LOCKS - 1);
+        }
+        // a range that wraps is [0, hi] and [lo, LOCKS - 1]
+        wraps = lo > hi;
+        for_each([](std::mutex& m){ m.lock(); });
+      }
+
+      ~segment_lock(){
+        for_each([](std::mutex& m){ m.unlock(); });
+      }
+
+      segment_lock(const segment_lock&) = delete;
+      segment_lock& operator=(const segment_lock&) = delete;
+
+    private:
+      template<typename F>
+      void for_each(F f){
+        if(wraps){
+          for(size_t i = 0; i <= hi; i++) f(p.locks[i]);
+          for(size_t i = lo; i < LOCKS; i++) f(p.locks[i]);
+        }
+        else{
+          for(size_t i = lo; i <= hi; i++) f(p.locks[i]);
+        }
+      }
+
+      const cuckoo_hopscotch& p;
+      size_t lo, hi;
+      bool wraps;
+    };
+
+    // The bucket holding key, or NONE. The home's segments must be held.
+    size_t find(const Key& key, size_t home) const{
+      uint32_t hop = buckets[home].hop;
+      while(hop != 0){
+        size_t d = __builtin_ctz(hop);
+        if(Slots::holds(buckets[home + d].slot, key)) return home + d;
+        hop &= hop - 1;
+      }
+      return NONE;
+    }
+
+    void place(Key&& key, size_t home, size_t b){
+      buckets[b].slot = std::move(key);
+      buckets[home].hop |= uint32_t(1) << (b - home);
+      size_++;
+    }
+
+    // An empty bucket of `to` within home's neighborhood, or NONE. The first
+    // empty bucket within the add range is hopped back until it is close
+    // enough; path counts the keys moved. The caller holds the segments of
+    // the add range.
+    size_t claim(bucket_array& to, size_t home, size_t& path) const{
+      size_t end = std::min(home + add_range, to.size());
+      size_t free = home;
+      while(free < end && !Slots::is_empty(to[free].slot)) free++;
+      while(free < end && free - home >= neighborhood_){
+        free = hop_closer(to, free);
+        path++;
+      }
+      return free < end ? free : NONE;
+    }
+
+    // Moves a key from a bucket before the empty bucket `free` into it,
+    // keeping that key within its own home's neighborhood, and returns the
+    // bucket it left, now empty. Homes are tried farthest first, and within
+    // a home the key nearest to it, so the empty bucket moves as far back as
+    // it can. Returns to.size() if no key can move.
+    size_t hop_closer(bucket_array& to, size_t free) const{
+      for(size_t home = free - (neighborhood_ - 1); home < free; home++){
+        uint32_t hop = to[home].hop;
+        if(hop == 0) continue;
+        size_t d = __builtin_ctz(hop);
+        if(home + d >= free) continue;
+        to[free].slot = std::move(to[home + d].slot);
+        to[home + d].slot = Slots::empty();
+        to[home].hop = (hop | (uint32_t(1) << (free - home))) & ~(uint32_t(1) << d);
+        return home + d;
+      }
+      return to.size();
+    }
+
+    // Doubles the table, unless another thread already resized it since
+    // `observed` was read. The keys are moved out and placed again on this
+    // thread, with every lock held: a key's new home is not adjacent to its
+    // old one, so unlike cuckoo_seq the buckets cannot be split. If a key
+    // then finds no room, the table doubles again.
+    void resize(size_t observed){
+      stat_timer wait;
+      std::unique_lock<std::mutex> resize_lock(resize_mtx);
+      stats_.resize_wait_ns.add(wait.elapsed_ns());
+      if(capacity != observed) return;
+
+      stat_timer timer;
+      segment_lock lock(*this, 0, buckets.size());
+      std::vector<Key> keys;
+      keys.reserve(size_);
+      drain(buckets, keys);
+      Alloc alloc(next_generation(buckets.get_allocator()));
+      size_t cap = capacity;
+      while(true){
+        cap *= 2;
+        bucket_array next(cap + neighborhood_ - 1, alloc);
+        size_t placed = 0;
+        while(placed < keys.size() && rehash(next, cap, keys[placed])) placed++;
+        if(placed == keys.size()){
+          buckets = std::move(next);
+          break;
+        }
+        // start over from the keys in next and the ones not yet placed
+        std::vector<Key> rest;
+        rest.reserve(keys.size());
+        drain(next, rest);
+        for(size_t i = placed; i < keys.size(); i++) rest.push_back(std::move(keys[i]));
+        keys = std::move(rest);
+      }
+      capacity = cap;
+      stats_.resizes.add();
+      stats_.resize_ns.add(timer.elapsed_ns());
+    }
+
+    void drain(bucket_array& from, std::vector<Key>& keys){
+      for(bucket& b : from){
+        if(Slots::is_empty(b.slot)) continue;
+        keys.push_back(std::move(Slots::key(b.slot)));
+        b.slot = Slots::empty();
+      }
+    }
+
+    // add() into a table under construction, which no other thread sees.
+    // Moves key only if it finds it a bucket.
+    bool rehash(bucket_array& to, size_t cap, Key& key) const{
+      size_t home = hash1(key) & (cap - 1);
+      size_t path = 0;
+      size_t free = claim(to, home, path);
+      if(free == NONE) return false;
+      to[free].slot = std::move(key);
+      to[home].hop |= uint32_t(1) << (free - home);
+      return true;
+    }
+
+    size_t next_power_of_two(size_t n){
+      if (n == 0) return 1;
+      // If already a power of two, return n
+      if ((n & (n - 1)) == 0) return n;
+      // Otherwise, round up
+      size_t power = 1;
+      while (power < n) power <<= 1;
+      return power;
+    }
+
+    std::atomic<size_t> capacity; // home buckets, a power of two
+    std::atomic<size_t> size_;
+    const size_t neighborhood_;
+    const size_t add_range;
+    bucket_array buckets;
+    mutable std::vector<std::mutex> locks;
+    mutable std::mutex resize_mtx;
+
+    myhash::StdHash1<Key> hash1;
+
+    stats_block stats_;
+
+    inline static size_t NEIGHBORHOOD = 8;
+    inline static size_t ADD_RANGE = 128;
+
+    inline static constexpr size_t SEGMENT_BUCKETS = 32;
+    inline static constexpr size_t LOCKS = 1024;
+};
+
+} // namespace cuckoo
@@ -0,0 +1,226 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+#include "bucket_allocator.h"
+#include "cuckoo_seq.h"
+#include "cuckoo_stats.h"
+#include "hashes.h"
+
+namespace cuckoo {
+
+// Read-optimized engine for read-mostly workloads. Readers look keys up in
+// an immutable cuckoo_seq reached through an atomically published pointer:
+// no locks, and the only write is to the reader's own counter line. Writers
+// copy the current version, apply a whole batch of changes to the copy
+// (update()), publish it with one pointer store, and free the old version
+// after a grace period in which every reader that could still see it has
+// left.
+//
+// Readers register in one of two phases per slot, SRCU style. A grace
+// period flips the phase and waits for the old one to drain, twice, so both
+// phases have emptied since the new version went out; new readers always
+// enter the other phase, so a steady stream of them cannot hold a writer
+// off. add() and remove() are batches of one, but writers that queue up
+// while another publishes are applied together in the next version.
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>>
+class cuckoo_rcu {
+public:
+    using key_type = Key;
+    using version = cuckoo_seq<Key, Alloc>;
+
+    explicit cuckoo_rcu(size_t capacity = 16, const Alloc& alloc = Alloc())
+        : current(new version(capacity, alloc)){}
+
+    ~cuckoo_rcu(){
+      delete current.load();
+    }
+
+    cuckoo_rcu(const cuckoo_rcu&) = delete;
+    cuckoo_rcu& operator=(const cuckoo_rcu&) = delete;
+
+    static void configure(size_t max_relocations)
+    {
+      version::configure(max_relocations);
+    }
+
+    bool contains(const Key& key) const{
+      read_guard guard(*this);
+      return current.load()->contains(key);
+    }
+
+    // found[i] = contains(keys[i]), all against the same version.
+    void contains_batch(std::span<const Key> keys, std::span<bool> found,
+                        size_t group = AMAC_GROUP) const{
+      read_guard guard(*this);
+      current.load()->contains_batch(keys, found, group);
+    }
+
+    template<std::convertible_to<Key> K>
+    bool add(K&& keyParam){
+      write_request req{true, Key(std::forward<K>(keyParam))};
+      submit(req);
+      return req.result;
+    }
+
+    bool remove(const Key& key){
+      write_request req{false, key};
+      submit(req);
+      return req.result;
+    }
+
+    // Calls fn(next) on a private copy of the current version, then
+    // publishes it. fn may use any member of cuckoo_seq; readers see all of
+    // its changes at once or none of them. Returns once the version it
+    // replaced has been freed.
+    template<typename F>
+    void update(F&& fn){
+      std::unique_lock<std::mutex> lock(writer_mtx);
+      publish([&](version& next){ fn(next); });
+    }
+
+    // Removes every key for which pred(key) is true and returns how many
+    // went, in one new version.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      size_t erased = 0;
+      update([&](version& next){ erased = next.erase_if(pred); });
+      return erased;
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
+    size_t size() const {
+      read_guard guard(*this);
+      return current.load()->size();
+    }
+
+    size_t bucket_count() const {
+      read_guard guard(*this);
+      return current.load()->bucket_count();
+    }
+
+    cuckoo_stats stats() const {
+      read_guard guard(*this);
+      return current.load()->stats();
+    }
+
+    // Bytes of the current version, plus the reader counters. An update()
+    // holds a second version, its copy, until it publishes.
+    cuckoo_memory memory_usage() const {
+      read_guard guard(*this);
+      cuckoo_memory m = current.load()->memory_usage();
+      m.lock_bytes += sizeof(readers);
+      return m;
+    }
+
+    // Versions published so far; each write batch makes one
+    size_t versions() const {
+      return versions_;
+    }
+
+    void populate(std::vector<Key>& values){
+      update([&](version& next){ next.populate(values); });
+    }
+
+private:
+    struct write_request {
+      bool is_add;
+      Key key;
+      bool result = false;
+      bool done = false; // set under writer_mtx by whoever applied it
+    };
+
+    struct alignas(64) reader_slot {
+      std::atomic<uint32_t> active[2] = {0, 0};
+    };
+
+    class read_guard {
+    public:
+      explicit read_guard(const cuckoo_rcu& t)
+          : slot(t.readers[reader_index()]),
+            phase(t.phase.load()){
+        slot.active[phase].fetch_add(1);
+      }
+      ~read_guard(){
+        slot.active[phase].fetch_sub(1);
+      }
+    private:
+      reader_slot& slot;
+      uint32_t phase;
+    };
+
+    // Queues req and waits for writer_mtx. If a writer that held it took
+    // req along, there is nothing left to do; otherwise this thread applies
+    // everything queued so far.
+    void submit(write_request& req){
+      {
+        std::unique_lock<std::mutex> lock(pending_mtx);
+        pending.push_back(&req);
+      }
+      std::unique_lock<std::mutex> lock(writer_mtx);
+      if(req.done) return;
+      std::vector<write_request*> batch;
+      {
+        std::unique_lock<std::mutex> pending_lock(pending_mtx);
+        batch.swap(pending);
+      }
+      publish([&](version& next){
+        for(write_request* r : batch)
+          r->result = r->is_add ? next.add(std::move(r->key)) : next.remove(r->key);
+      });
+      for(write_request* r : batch) r->done = true;
+    }
+
+    // Called with writer_mtx held.
+    template<typename F>
+    void publish(F&& apply){
+      version* old = current.load();
+      std::unique_ptr<version> next(new version(*old));
+      apply(*next);
+      current.store(next.release());
+      synchronize();
+      delete old;
+      versions_++;
+    }
+
+    // Waits until no reader can still hold a version unpublished before
+    // this call.
+    void synchronize(){
+      for(int round = 0; round < 2; round++){
+        uint32_t old_phase = phase.load();
+        phase.store(1 - old_phase);
+        for(reader_slot& slot : readers){
+          while(slot.active[old_phase].load() != 0) std::this_thread::yield();
+        }
+      }
+    }
+
+    static size_t reader_index(){
+      static std::atomic<size_t> next_index{0};
+      thread_local size_t index = next_index.fetch_add(1) % READER_SLOTS;
+      return index;
+    }
+
+    // Reader counters, one cache line each; threads beyond this share them
+    inline static constexpr size_t READER_SLOTS = 64;
+
+    std::atomic<version*> current;
+    std::atomic<uint32_t> phase{0};
+    mutable reader_slot readers[READER_SLOTS];
+
+    std::mutex writer_mtx;
+    std::mutex pending_mtx;
+    std::vector<write_request*> pending;
+    std::atomic<size_t> versions_{0};
+};
+
+} // namespace cuckoo
@@ -1,18 +1,32 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
-#include <optional>
+#include "amac.h"
+#include "bucket_allocator.h"
+#include "cuckoo_stats.h"
 #include "hashes.h"
+#include "slot_traits.h"
+#include "task_pool.h"
 
 namespace cuckoo {
 
-template<myhash::HashableAndEquatable Key>
+// Slots picks how empty slots are marked (see slot_traits.h).
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>,
+         typename Slots = optional_slots<Key>>
 class cuckoo_seq {
 public:
-    explicit cuckoo_seq(size_t capacity = 16)
+    using key_type = Key;
+
+    explicit cuckoo_seq(size_t capacity = 16, const Alloc& alloc = Alloc())
         : capacity(next_power_of_two(capacity)),
           size_(0),
-          table1(this->capacity, std::nullopt),
-          table2(this->capacity, std::nullopt){}
+          table1(empty_slots(this->capacity, alloc)),
+          table2(empty_slots(this->capacity, alloc)){}
 
     static void configure(size_t max_relocations) 
     {
@@ -22,6 +36,9 @@ public:
     template<std::convertible_to<Key> K>
     bool add(K&& keyParam){
       Key key = std::forward<K>(keyParam);
+      if(Slots::reserved(key)){
+        throw std::invalid_argument("cuckoo_seq: key is reserved for empty slots");
+      }
       
       if(contains(key)){
         return false;
@@ -29,48 +46,103 @@ public:
 
       for (size_t i = 0; i < MAX_RELOCATIONS; ++i) {
         auto& slot1 = table1[bucket1(key)];
-        if (!slot1) {
-          slot1.emplace(std::move(key));
+        if (Slots::is_empty(slot1)) {
+          slot1 = std::move(key);
           ++size_;
+          stats_.record_insert(2 * i);
           return true;
         } else {
-          std::swap(*slot1, key);
+          std::swap(Slots::key(slot1), key);
         }
 
         auto& slot2 = table2[bucket2(key)];
-        if (!slot2) {
-          slot2.emplace(std::move(key));
+        if (Slots::is_empty(slot2)) {
+          slot2 = std::move(key);
           ++size_;
+          stats_.record_insert(2 * i + 1);
           return true;
         } else {
-          std::swap(*slot2, key);
+          std::swap(Slots::key(slot2), key);
         }
       }
+      stats_.relocation_failures.add();
       resize();
       return add(std::move(key));
     }
 
     bool contains(const Key& key) const{
-      return table1[bucket1(key)] == key 
-          || table2[bucket2(key)] == key;
+      if(Slots::reserved(key)) return false;
+      return Slots::holds(table1[bucket1(key)], key)
+          || Slots::holds(table2[bucket2(key)], key);
+    }
+
+    // found[i] = contains(keys[i]), with `group` lookups interleaved so their
+    // cache misses overlap (see amac.h).
+    void contains_batch(std::span<const Key> keys, std::span<bool> found,
+                        size_t group = AMAC_GROUP) const{
+      group = std::max<size_t>(1, std::min(group, keys.size()));
+      amac_run(group, [&](size_t first){
+        return lookup_stream(keys, found, first, group);
+      });
     }
 
     bool remove(const Key& key){
+      if(Slots::reserved(key)) return false;
       size_t h1 = bucket1(key);
       size_t h2 = bucket2(key);
-      if(table1[h1] == key)
-        table1[h1] = std::nullopt;
-      else if(table2[h2] == key)
-        table2[h2] = std::nullopt;
+      if(Slots::holds(table1[h1], key))
+        table1[h1] = Slots::empty();
+      else if(Slots::holds(table2[h2], key))
+        table2[h2] = Slots::empty();
       else return false;
       --size_;
       return true;
     }
 
+    // Removes every key for which pred(key) is true and returns how many
+    // went. Ranges of slots are cleared on the task pool, so pred may be
+    // called from several threads at once; the table itself must not be
+    // used concurrently, as with every other member.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      std::atomic<size_t> erased{0};
+      parallel_for(0, capacity, SCAN_CHUNK, [&](size_t begin, size_t end){
+        size_t n = 0;
+        for (size_t b = begin; b < end; ++b) {
+          if (!Slots::is_empty(table1[b]) && pred(Slots::key(table1[b]))) { table1[b] = Slots::empty(); ++n; }
+          if (!Slots::is_empty(table2[b]) && pred(Slots::key(table2[b]))) { table2[b] = Slots::empty(); ++n; }
+        }
+        erased += n;
+      });
+      size_ -= erased;
+      return erased;
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
     size_t size() const { 
       return size_; 
     }
 
+    size_t bucket_count() const {
+      return capacity;
+    }
+
+    cuckoo_stats stats() const {
+      return stats_.snapshot();
+    }
+
+    // Bytes allocated for the table: the two slot arrays.
+    cuckoo_memory memory_usage() const {
+      cuckoo_memory m;
+      m.table_bytes = (table1.capacity() + table2.capacity()) * sizeof(slot_type);
+      return m;
+    }
+
     void populate(std::vector<Key>& values){
       for(Key& key : values){
         add(key);
@@ -79,24 +151,44 @@ public:
     }
 
 private:
+    friend struct bench_access; // tests/bench_micro.cpp
+
+    amac_task lookup_stream(std::span<const Key> keys, std::span<bool> found,
+                            size_t first, size_t stride) const{
+      for (size_t i = first; i < keys.size(); i += stride) {
+        const Key& key = keys[i];
+        size_t b1 = bucket1(key);
+        size_t b2 = bucket2(key);
+        prefetch(&table1[b1]);
+        prefetch(&table2[b2]);
+        co_await amac_yield{};
+        found[i] = !Slots::reserved(key)
+                && (Slots::holds(table1[b1], key) || Slots::holds(table2[b2], key));
+      }
+    }
+
     void resize(){
-      if (capacity > (1 << 25)) throw std::runtime_error("Hash table too large. Check hash function");
+      stat_timer timer;
+      size_t old_capacity = capacity;
       capacity *= 2;
       
-      std::vector<std::optional<Key>> old_table1 = std::move(table1);
-      std::vector<std::optional<Key>> old_table2 = std::move(table2);
+      slot_array old_table1 = std::move(table1);
+      slot_array old_table2 = std::move(table2);
       
-      table1.assign(capacity, std::nullopt);
-      table2.assign(capacity, std::nullopt);
+      slot_alloc alloc = next_generation(old_table1.get_allocator());
+      table1 = empty_slots(capacity, alloc);
+      table2 = empty_slots(capacity, alloc);
       
-      size_ = 0; //updated by add
-      
-      for (auto& slot : old_table1) {
-        if (slot) add(std::move(*slot));
-      }
-      for (auto& slot : old_table2) {
-        if (slot) add(std::move(*slot));
+      // Buckets are hash & (capacity - 1), so the key in old slot b moves to
+      // b or b + old_capacity; no two old slots compete for a new one.
+      for (size_t b = 0; b < old_capacity; ++b) {
+        if (!Slots::is_empty(old_table1[b]))
+          table1[b | (hash1(Slots::key(old_table1[b])) & old_capacity)] = std::move(old_table1[b]);
+        if (!Slots::is_empty(old_table2[b]))
+          table2[b | (hash2(Slots::key(old_table2[b])) & old_capacity)] = std::move(old_table2[b]);
       }
+      stats_.resizes.add();
+      stats_.resize_ns.add(timer.elapsed_ns());
     }
 
     size_t next_power_of_two(size_t n){
@@ -117,15 +209,37 @@ private:
       return hash2(key) & (capacity - 1); // % capacity (since power of 2)
     }
 
+    using slot_type = typename Slots::slot_type;
+    using slot_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<slot_type>;
+    using slot_array = std::vector<slot_type, slot_alloc>;
+
+    // n empty slots. vector(n, value) copies value, which a std::optional
+    // of a move-only key cannot do, so those slots are assigned instead.
+    static slot_array empty_slots(size_t n, const slot_alloc& alloc){
+      if constexpr (std::is_copy_constructible_v<slot_type>){
+        return slot_array(n, Slots::empty(), alloc);
+      }
+      else{
+        slot_array slots(n, alloc);
+        for (slot_type& s : slots) s = Slots::empty();
+        return slots;
+      }
+    }
+
     size_t capacity; // must be power of two
     size_t size_;
-    std::vector<std::optional<Key>> table1;
-    std::vector<std::optional<Key>> table2;
+    slot_array table1;
+    slot_array table2;
+
+    myhash::StdHash1<Key> hash1;
+    myhash::StdHash2<Key> hash2;
 
-    myhash::StdHash1<std::optional<Key>> hash1;
-    myhash::StdHash2<std::optional<Key>> hash2;
+    stats_block stats_;
 
     inline static size_t MAX_RELOCATIONS = 16;
+
+    // Smallest range of slots worth handing to another thread in erase_if
+    inline static constexpr size_t SCAN_CHUNK = 4096;
 };
 
 } // namespace cuckoo
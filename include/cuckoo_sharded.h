@@ -0,0 +1,153 @@
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+#include "bucket_allocator.h"
+#include "cuckoo_seq.h"
+#include "cuckoo_stats.h"
+#include "hashes.h"
+
+namespace cuckoo {
+
+// Baseline engine: SHARDS independent cuckoo_seq tables, each behind a mutex
+// of its own. A key's shard is picked by the top bits of its hash1, which
+// the shards' bucket indices (the low bits) do not use. Every operation
+// takes exactly one lock, and a resize stalls only the shard that filled.
+// This is the simplest way to make cuckoo_seq concurrent, and so the one
+// the fine-grained engines have to beat.
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>,
+         size_t SHARDS = 64>
+class cuckoo_sharded {
+    static_assert(SHARDS > 1 && (SHARDS & (SHARDS - 1)) == 0, "SHARDS must be a power of two");
+
+    // Each shard on cache lines of its own, so that threads working on
+    // neighbouring shards do not share their mutexes' line.
+    struct alignas(64) shard {
+      std::mutex mtx;
+      cuckoo_seq<Key, Alloc> table;
+    };
+
+public:
+    using key_type = Key;
+
+    // capacity is split evenly over the shards
+    explicit cuckoo_sharded(size_t capacity = 16, const Alloc& alloc = Alloc())
+        : shards(SHARDS){
+      for(shard& s : shards){
+        s.table = cuckoo_seq<Key, Alloc>(std::max<size_t>(1, capacity / SHARDS), alloc);
+      }
+    }
+
+    // As cuckoo_seq::configure(), which the shards share.
+    static void configure(size_t max_relocations)
+    {
+      cuckoo_seq<Key, Alloc>::configure(max_relocations);
+    }
+
+    template<std::convertible_to<Key> K>
+    bool add(K&& keyParam){
+      Key key = std::forward<K>(keyParam);
+      shard& s = shard_of(key);
+      std::unique_lock<std::mutex> lock(s.mtx);
+      return s.table.add(std::move(key));
+    }
+
+    bool contains(const Key& key) const{
+      shard& s = shard_of(key);
+      std::unique_lock<std::mutex> lock(s.mtx);
+      return s.table.contains(key);
+    }
+
+    // found[i] = contains(keys[i]), one lock per key.
+    void contains_batch(std::span<const Key> keys, std::span<bool> found) const{
+      for (size_t i = 0; i < keys.size(); ++i) found[i] = contains(keys[i]);
+    }
+
+    bool remove(const Key& key){
+      shard& s = shard_of(key);
+      std::unique_lock<std::mutex> lock(s.mtx);
+      return s.table.remove(key);
+    }
+
+    // Removes every key for which pred(key) is true and returns how many
+    // went, one shard at a time under its lock. As cuckoo_seq::erase_if(),
+    // pred may be called from several threads at once.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      size_t erased = 0;
+      for(shard& s : shards){
+        std::unique_lock<std::mutex> lock(s.mtx);
+        erased += s.table.erase_if(pred);
+      }
+      return erased;
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
+    size_t size() const {
+      return sum([](const cuckoo_seq<Key, Alloc>& t){ return t.size(); });
+    }
+
+    // Buckets per table over all shards
+    size_t bucket_count() const {
+      return sum([](const cuckoo_seq<Key, Alloc>& t){ return t.bucket_count(); });
+    }
+
+    // The shards' counters added up; max_path is the longest in any shard.
+    cuckoo_stats stats() const {
+      cuckoo_stats s;
+      for(shard& sh : shards){
+        std::unique_lock<std::mutex> lock(sh.mtx);
+        s += sh.table.stats();
+      }
+      return s;
+    }
+
+    // The shards' slot arrays, plus each shard's mutex and the padding that
+    // keeps it on its own line.
+    cuckoo_memory memory_usage() const {
+      cuckoo_memory m;
+      for(shard& s : shards){
+        std::unique_lock<std::mutex> lock(s.mtx);
+        m += s.table.memory_usage();
+      }
+      m.lock_bytes += SHARDS * (sizeof(shard) - sizeof(cuckoo_seq<Key, Alloc>));
+      return m;
+    }
+
+    void populate(std::vector<Key>& values){
+      for(Key& key : values){
+        add(key);
+      }
+      return;
+    }
+
+private:
+    static constexpr int SHARD_BITS = __builtin_ctzll(SHARDS);
+
+    shard& shard_of(const Key& key) const {
+      return shards[hash1(key) >> (64 - SHARD_BITS)];
+    }
+
+    template<typename F>
+    size_t sum(F f) const {
+      size_t total = 0;
+      for(shard& s : shards){
+        std::unique_lock<std::mutex> lock(s.mtx);
+        total += f(s.table);
+      }
+      return total;
+    }
+
+    // mutable: contains() locks and works on the shard
+    mutable std::vector<shard> shards;
+    myhash::StdHash1<Key> hash1;
+};
+
+} // namespace cuckoo
@@ -0,0 +1,163 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace cuckoo {
+
+// Instrumentation is compiled in only when CUCKOO_STATS is defined
+// (make STATS=1). Otherwise every counter below is an empty struct and all
+// calls on it inline to nothing.
+#ifdef CUCKOO_STATS
+inline constexpr bool stats_enabled = true;
+#else
+inline constexpr bool stats_enabled = false;
+#endif
+
+// Displacement path lengths are bucketed 0..PATH_BUCKETS-2, with the last
+// bucket collecting everything longer.
+inline constexpr size_t PATH_BUCKETS = 33;
+
+// Snapshot returned by stats() on every engine.
+struct cuckoo_stats {
+    uint64_t inserts = 0;              // adds that placed a new key
+    uint64_t displacements = 0;        // keys moved to their alternate bucket
+    uint64_t max_path = 0;             // longest displacement path seen
+    uint64_t path_hist[PATH_BUCKETS] = {};
+    uint64_t relocation_failures = 0;  // displacement chains that gave up
+    uint64_t resizes = 0;
+    uint64_t resize_ns = 0;            // time spent inside resize()
+    uint64_t resize_wait_ns = 0;       // time spent waiting on resize_mtx
+    uint64_t lock_retries = 0;         // cuckoo_lock::acquire restarts
+    uint64_t tx_retries = 0;           // aborted, cancelled or deferred transactions
+
+    // Adds another table's counters, as for the shards of cuckoo_sharded;
+    // max_path is the longer of the two.
+    cuckoo_stats& operator+=(const cuckoo_stats& other) {
+      inserts += other.inserts;
+      displacements += other.displacements;
+      max_path = std::max(max_path, other.max_path);
+      for (size_t i = 0; i < PATH_BUCKETS; ++i) path_hist[i] += other.path_hist[i];
+      relocation_failures += other.relocation_failures;
+      resizes += other.resizes;
+      resize_ns += other.resize_ns;
+      resize_wait_ns += other.resize_wait_ns;
+      lock_retries += other.lock_retries;
+      tx_retries += other.tx_retries;
+      return *this;
+    }
+};
+
+// Returned by memory_usage() on every engine: the bytes the table has
+// allocated, counted at capacity rather than at what is in use.
+struct cuckoo_memory {
+    size_t table_bytes = 0;    // bucket and slot arrays
+    size_t lock_bytes = 0;     // mutexes, reader counters, gates
+    size_t overflow_bytes = 0; // probe-set arrays or nodes hanging off the buckets, arrays kept past a resize
+
+    size_t total() const { return table_bytes + lock_bytes + overflow_bytes; }
+
+    cuckoo_memory& operator+=(const cuckoo_memory& other) {
+      table_bytes += other.table_bytes;
+      lock_bytes += other.lock_bytes;
+      overflow_bytes += other.overflow_bytes;
+      return *this;
+    }
+};
+
+// What a separate heap block of n bytes costs. glibc malloc puts an 8-byte
+// header in front and rounds chunks up to 16 bytes, 32 at least; other
+// allocators are close enough for the estimate.
+inline size_t heap_block_bytes(size_t n) {
+    return n == 0 ? 0 : std::max<size_t>(32, (n + 8 + 15) & ~size_t(15));
+}
+
+#ifdef CUCKOO_STATS
+class stat_counter {
+public:
+    stat_counter() = default;
+    stat_counter(const stat_counter& other) : v(other.load()) {}
+    stat_counter& operator=(const stat_counter& other) { v = other.load(); return *this; }
+
+    void add(uint64_t n = 1) { v.fetch_add(n, std::memory_order_relaxed); }
+    void max(uint64_t n) {
+      uint64_t cur = v.load(std::memory_order_relaxed);
+      while (cur < n && !v.compare_exchange_weak(cur, n, std::memory_order_relaxed)) {}
+    }
+    uint64_t load() const { return v.load(std::memory_order_relaxed); }
+private:
+    std::atomic<uint64_t> v{0};
+};
+
+class stat_timer {
+public:
+    uint64_t elapsed_ns() const {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now() - start).count();
+    }
+private:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+};
+#else
+struct stat_counter {
+    void add(uint64_t = 1) {}
+    void max(uint64_t) {}
+    uint64_t load() const { return 0; }
+};
+
+struct stat_timer {
+    uint64_t elapsed_ns() const { return 0; }
+};
+#endif
+
+// Counters embedded in each engine.
+struct stats_block {
+    stat_counter inserts;
+    stat_counter displacements;
+    stat_counter max_path;
+    stat_counter path_hist[PATH_BUCKETS];
+    stat_counter relocation_failures;
+    stat_counter resizes;
+    stat_counter resize_ns;
+    stat_counter resize_wait_ns;
+    stat_counter lock_retries;
+    stat_counter tx_attempts;
+    stat_counter tx_commits;
+    stat_counter tx_deferrals;
+
+    // An insert that completed after moving `path` other keys.
+    void record_insert(size_t path) {
+      inserts.add();
+      displacements.add(path);
+      max_path.max(path);
+      path_hist[std::min(path, PATH_BUCKETS - 1)].add();
+    }
+
+    cuckoo_stats snapshot() const {
+      cuckoo_stats s;
+      s.inserts = inserts.load();
+      s.displacements = displacements.load();
+      s.max_path = max_path.load();
+      for (size_t i = 0; i < PATH_BUCKETS; ++i) s.path_hist[i] = path_hist[i].load();
+      s.relocation_failures = relocation_failures.load();
+      s.resizes = resizes.load();
+      s.resize_ns = resize_ns.load();
+      s.resize_wait_ns = resize_wait_ns.load();
+      s.lock_retries = lock_retries.load();
+      uint64_t attempts = tx_attempts.load();
+      uint64_t commits = tx_commits.load();
+      s.tx_retries = (attempts > commits ? attempts - commits : 0) + tx_deferrals.load();
+      return s;
+    }
+};
+
+// Called from inside __transaction_atomic blocks. transaction_pure keeps the
+// increment out of the transaction's undo log, so every attempt is counted,
+// including the ones libitm aborts and restarts.
+__attribute__((transaction_pure)) inline void note_tx_attempt(stat_counter& attempts) {
+    attempts.add();
+}
+
+} // namespace cuckoo
@@ -1,21 +1,32 @@
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <optional>
+#include <span>
 #include <thread>
 #include <vector>
+#include "amac.h"
+#include "bucket_allocator.h"
+#include "cuckoo_stats.h"
 #include "hashes.h"
+#include "task_pool.h"
 
 namespace cuckoo {
 
-template<myhash::HashableAndEquatable Key>
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>>
 class cuckoo_striped {
 public:
-    explicit cuckoo_striped(size_t capacity = 16)
+    using key_type = Key;
+
+    explicit cuckoo_striped(size_t capacity = 16, const Alloc& alloc = Alloc())
         : capacity(next_power_of_two(capacity)),
           size_(0),
-          table1(this->capacity, std::vector<Key>(0)),
-          table2(this->capacity, std::vector<Key>(0)),
+          table1(empty_buckets(this->capacity, alloc)),
+          table2(empty_buckets(this->capacity, alloc)),
+          heads1(table1.data()),
+          heads2(table2.data()),
           mtx1(this->capacity),
           mtx2(this->capacity){}
 
@@ -43,30 +54,33 @@ public:
       size_t b1 = h1 & (capacity - 1);
       size_t b2 = h2 & (capacity - 1);
 
-      int i = -1, h = -1;
+      int i = -1;
+      size_t h = 0;
       bool mustResize = false;
       if(present(key, b1, b2)) return false;
 
-      std::vector<Key>& set1 = table1[b1];
-      std::vector<Key>& set2 = table2[b2];
+      probe_set& set1 = table1[b1];
+      probe_set& set2 = table2[b2];
       
       if(set1.size() < THRESHOLD){
-        set1.push_back(key);
+        set1.push_back(std::move(key));
         size_++;
+        stats_.record_insert(0);
         return true;
       }
       else if(set2.size() < THRESHOLD){
-        set2.push_back(key);
+        set2.push_back(std::move(key));
         size_++;
+        stats_.record_insert(0);
         return true;
       }
       else if(set1.size() < PROBE_SIZE){
-        set1.push_back(key);
+        set1.push_back(std::move(key));
         i = 0;
         h = b1;
       }
       else if(set2.size() < PROBE_SIZE){
-        set2.push_back(key);
+        set2.push_back(std::move(key));
         i = 1;
         h = b2;
       }
@@ -78,12 +92,15 @@ public:
 
       if(mustResize){
         resize();
-        add(key);
+        add(std::move(key));
+        return true;
       }
-      else if(!relocate(i, h)){
+      // key is in the table from here on, whether or not relocate succeeds
+      size_++;
+      if(!relocate(i, h)){
+        stats_.relocation_failures.add();
         resize();
       }
-      else size_++;
       return true;
     }
 
@@ -98,6 +115,16 @@ public:
       return present(key, h1 & (capacity - 1), h2 & (capacity - 1));
     }
 
+    // found[i] = contains(keys[i]), with `group` lookups interleaved so their
+    // cache misses overlap (see amac.h).
+    void contains_batch(std::span<const Key> keys, std::span<bool> found,
+                        size_t group = AMAC_GROUP) const{
+      group = std::max<size_t>(1, std::min(group, keys.size()));
+      amac_run(group, [&](size_t first){
+        return lookup_stream(keys, found, first, group);
+      });
+    }
+
     bool remove(const Key& key){
       size_t h1 = hash1(key);
       size_t h2 = hash2(key);
@@ -106,7 +133,7 @@ public:
       std::unique_lock<std::recursive_mutex> lock2(mtx2[h2 & (mtx2.size() - 1)]);
       
       size_t b1 = h1 & (capacity - 1);
-      std::vector<Key>& set1 = table1[b1];
+      probe_set& set1 = table1[b1];
       auto it = std::find(set1.begin(), set1.end(), key);
       if(it != set1.end()){
         set1.erase(it);
@@ -115,7 +142,7 @@ public:
       }
       
       size_t b2 = h2 & (capacity - 1);
-      std::vector<Key>& set2 = table2[b2];
+      probe_set& set2 = table2[b2];
       it = std::find(set2.begin(), set2.end(), key);
       if(it != set2.end()){
         set2.erase(it);
@@ -125,10 +152,76 @@ public:
       return false;
     }
 
+    // Removes every key for which pred(key) is true and returns how many
+    // went. Ranges of stripes are scanned on the task pool: each task locks
+    // its stripes once, in index order as resize() does, and compacts their
+    // probe sets in place. resize_mtx is held throughout, so no key is moved
+    // by a relocation or a resize while the scan runs. pred may be called
+    // from several threads at once.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      size_t stripes = mtx1.size();
+      size_t grain = std::max<size_t>(1, SCAN_CHUNK * stripes / capacity);
+      std::atomic<size_t> erased{0};
+      parallel_for(0, stripes, grain, [&](size_t begin, size_t end){
+        std::vector<std::unique_lock<std::recursive_mutex>> locks;
+        for(size_t s = begin; s < end; s++)
+          locks.emplace_back(mtx1[s]);
+        for(size_t s = begin; s < end; s++)
+          locks.emplace_back(mtx2[s]);
+        // stripe s guards buckets s, s + stripes, s + 2 * stripes, ...
+        size_t n = 0;
+        for(size_t base = 0; base < capacity; base += stripes){
+          for(size_t b = base + begin; b < base + end; b++){
+            n += std::erase_if(table1[b], pred);
+            n += std::erase_if(table2[b], pred);
+          }
+        }
+        size_ -= n;
+        erased += n;
+      });
+      return erased;
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
     size_t size() const { 
       return size_; 
     }
 
+    size_t bucket_count() const {
+      return capacity;
+    }
+
+    cuckoo_stats stats() const {
+      return stats_.snapshot();
+    }
+
+    // Bytes allocated for the table. Each probe set's array is a heap block
+    // of its own, counted as overflow. resize_mtx is held and the stripes
+    // are locked a pair at a time, as erase_if() does.
+    cuckoo_memory memory_usage() const {
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      cuckoo_memory m;
+      m.table_bytes = (table1.capacity() + table2.capacity()) * sizeof(probe_set);
+      m.lock_bytes = (mtx1.size() + mtx2.size() + 1) * sizeof(std::recursive_mutex);
+      size_t stripes = mtx1.size();
+      for(size_t s = 0; s < stripes; s++){
+        std::unique_lock<std::recursive_mutex> lock1(mtx1[s]);
+        std::unique_lock<std::recursive_mutex> lock2(mtx2[s]);
+        for(size_t b = s; b < capacity; b += stripes){
+          m.overflow_bytes += heap_block_bytes(table1[b].capacity() * sizeof(Key));
+          m.overflow_bytes += heap_block_bytes(table2[b].capacity() * sizeof(Key));
+        }
+      }
+      return m;
+    }
+
     void populate(std::vector<Key>& values){
       for(Key& key : values){
         add(key);
@@ -137,82 +230,155 @@ public:
     }
 
 private:
+    friend struct bench_access; // tests/bench_micro.cpp
+
+    using probe_set = std::vector<Key, Alloc>;
+    using bucket_array = std::vector<probe_set, typename std::allocator_traits<Alloc>::template rebind_alloc<probe_set>>;
+
+    // A probe is three dependent misses per table: the stripe lock (there is
+    // one per initial bucket), the probe set header in the bucket array, then
+    // its keys. The locks and headers are prefetched before suspending. The
+    // stripe locks are never held across a suspension, since a thread parked
+    // on one stream's locks while holding another's could deadlock with
+    // add(), so the headers are found through heads1/heads2 and capacity,
+    // which resize() publishes atomically. If a resize lands in between, the
+    // prefetch was wasted but harmless (a prefetch cannot fault), and the
+    // probe under the locks reads the new arrays. Once the locks are held,
+    // both tables' keys are prefetched together before probing.
+    amac_task lookup_stream(std::span<const Key> keys, std::span<bool> found,
+                            size_t first, size_t stride) const{
+      for (size_t i = first; i < keys.size(); i += stride) {
+        const Key& key = keys[i];
+        size_t h1 = hash1(key);
+        size_t h2 = hash2(key);
+        std::recursive_mutex& m1 = mtx1[h1 & (mtx1.size() - 1)];
+        std::recursive_mutex& m2 = mtx2[h2 & (mtx2.size() - 1)];
+        size_t cap = capacity.load(std::memory_order_acquire);
+        prefetch(&m1);
+        prefetch(&m2);
+        prefetch(heads1.load(std::memory_order_acquire) + (h1 & (cap - 1)));
+        prefetch(heads2.load(std::memory_order_acquire) + (h2 & (cap - 1)));
+        co_await amac_yield{};
+        std::unique_lock<std::recursive_mutex> lock1(m1);
+        std::unique_lock<std::recursive_mutex> lock2(m2);
+        size_t b1 = h1 & (capacity - 1);
+        size_t b2 = h2 & (capacity - 1);
+        prefetch(table1[b1].data());
+        prefetch(table2[b2].data());
+        found[i] = present(key, b1, b2);
+      }
+    }
+
     void resize(){
-      if (capacity > (1 << 25)) throw std::runtime_error("Hash table too large. Check hash function");
       
       needResize = true;
+      stat_timer wait;
       std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      stats_.resize_wait_ns.add(wait.elapsed_ns());
       if(!needResize) return;
 
+      stat_timer timer;
       std::vector<std::unique_lock<std::recursive_mutex>> locks;
       for(std::recursive_mutex& mtx : mtx1){
         locks.push_back(std::unique_lock<std::recursive_mutex>(mtx));
       }
-      
-      size_ = 0; //updated by add
 
       capacity = capacity * 2;
-      std::vector<std::vector<Key>> old_table1(capacity);
-      std::vector<std::vector<Key>> old_table2(capacity);
+      // the new table gets its own allocator generation, so an arena holding
+      // the old buckets is released in bulk when old_table1/2 go away
+      Alloc alloc(next_generation(table1.get_allocator()));
+      bucket_array old_table1 = empty_buckets(capacity, alloc);
+      bucket_array old_table2 = empty_buckets(capacity, alloc);
       std::swap(old_table1, table1);
       std::swap(old_table2, table2);
+      heads1.store(table1.data(), std::memory_order_release);
+      heads2.store(table2.data(), std::memory_order_release);
 
-      for(std::vector<Key>& set : old_table1){
-        for(Key& z : set){
-          add(std::move(z));
-        }
-      }
-      for(std::vector<Key>& set : old_table2){
-        for(Key& z : set){
-          add(std::move(z));
-        }
-      }
+      split(old_table1, old_table2);
       needResize = false;
+      stats_.resizes.add();
+      stats_.resize_ns.add(timer.elapsed_ns());
+    }
+
+    // Capacity doubles and buckets are hash & (capacity - 1), so the keys of
+    // old bucket b can only land in b or b + old_capacity. Each new bucket is
+    // fed by exactly one old bucket, so ranges of old buckets are split on
+    // several threads with no locking, lookups or displacement.
+    void split(bucket_array& old_table1, bucket_array& old_table2){
+      size_t old_capacity = old_table1.size();
+      parallel_for(0, old_capacity, SPLIT_CHUNK, [&](size_t begin, size_t end){
+        for(size_t b = begin; b < end; b++){
+          for(Key& z : old_table1[b]){
+            table1[b | (hash1(z) & old_capacity)].push_back(std::move(z));
+          }
+          for(Key& z : old_table2[b]){
+            table2[b | (hash2(z) & old_capacity)].push_back(std::move(z));
+          }
+        }
+      });
     }
 
-    bool present(Key key, size_t b1, size_t b2) const{
-      const std::vector<Key>& set1 = table1[b1];
+    bool present(const Key& key, size_t b1, size_t b2) const{
+      const probe_set& set1 = table1[b1];
       auto it1 = std::find(set1.begin(), set1.end(), key);
       if(it1 != set1.end()) return true;
       
-      const std::vector<Key>& set2 = table2[b2];
+      const probe_set& set2 = table2[b2];
       auto it2 = std::find(set2.begin(), set2.end(), key);
       return it2 != set2.end();
     }
 
-    bool relocate(int i, int hi){
+    bool relocate(int i, size_t hi){
+      stat_timer wait;
       std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
-      int hj = 0;
+      stats_.resize_wait_ns.add(wait.elapsed_ns());
+      size_t hj = 0;
+      size_t path = 0;
       int j = 1 - i;
       for(size_t round = 0; round < LIMIT; round++){
-        std::vector<Key>& iSet = ((i == 0) ? table1 : table2)[hi];
-        if(iSet.size() == 0) return true;
-        Key y = iSet[0];
-        
-        size_t hj1 = hash1(y);
-        size_t hj2 = hash2(y);
+        probe_set& iSet = ((i == 0) ? table1 : table2)[hi];
+        // Only the front key's hashes are read, under iSet's stripes; the key
+        // is moved out once both of its own stripes are held, taken in the
+        // usual order.
+        size_t hj1, hj2;
+        {
+          std::unique_lock<std::recursive_mutex> lock1(mtx1[hi & (mtx1.size() - 1)]);
+          std::unique_lock<std::recursive_mutex> lock2(mtx2[hi & (mtx2.size() - 1)]);
+          if(iSet.size() == 0){
+            stats_.record_insert(path);
+            return true;
+          }
+          hj1 = hash1(iSet[0]);
+          hj2 = hash2(iSet[0]);
+        }
 
         std::unique_lock<std::recursive_mutex> lock1(mtx1[hj1 & (mtx1.size() - 1)]);
         std::unique_lock<std::recursive_mutex> lock2(mtx2[hj2 & (mtx2.size() - 1)]);
         
-        hj = (j == 0) ? (hj1 & (capacity - 1)) : (hj2 & (capacity - 1));
-        std::vector<Key>& jSet = ((j == 0) ? table1 : table2)[hj];
+        size_t hjj = (j == 0) ? hj1 : hj2;
+        hj = hjj & (capacity - 1);
+        probe_set& jSet = ((j == 0) ? table1 : table2)[hj];
         
-        auto it = std::find(iSet.begin(), iSet.end(), y);
-        if(it != iSet.end()){
-          iSet.erase(it);
+        // The front key may have changed in between. Any key in iSet with
+        // the same hash has the same two buckets, so the stripes held are its
+        // own and it can move instead.
+        if(iSet.size() != 0 && ((j == 0) ? hash1(iSet[0]) : hash2(iSet[0])) == hjj){
+          Key y = std::move(iSet[0]);
+          iSet.erase(iSet.begin());
+          path++;
           if(jSet.size() < THRESHOLD){
-            jSet.push_back(y);
+            jSet.push_back(std::move(y));
+            stats_.record_insert(path);
             return true;
           }
           else if(jSet.size() < PROBE_SIZE){
-            jSet.push_back(y);
+            jSet.push_back(std::move(y));
             i = 1 - i;
             hi = hj;
             j = 1 - j;
           }
           else{
-            iSet.push_back(y);
+            iSet.push_back(std::move(y));
             return false;
           }
         }
@@ -220,12 +386,22 @@ private:
           continue;
         }
         else{
+          stats_.record_insert(path);
           return true;
         }
       }
       return false;
     }
 
+    // n empty probe sets. vector(n, value) would copy the empty set, which
+    // a vector of move-only keys cannot do.
+    static bucket_array empty_buckets(size_t n, const Alloc& alloc){
+      bucket_array buckets(alloc);
+      buckets.reserve(n);
+      for(size_t b = 0; b < n; b++) buckets.emplace_back(alloc);
+      return buckets;
+    }
+
     size_t next_power_of_two(size_t n){
       if (n == 0) return 1;
       // If already a power of two, return n
@@ -238,21 +414,31 @@ private:
 
     std::atomic<size_t> capacity; // must be power of two
     std::atomic<size_t> size_;
-    std::vector<std::vector<Key>> table1;
-    std::vector<std::vector<Key>> table2;
+    bucket_array table1;
+    bucket_array table2;
+    // table1/table2.data(), for lookup_stream() to prefetch without locks
+    std::atomic<const probe_set*> heads1;
+    std::atomic<const probe_set*> heads2;
     
     mutable std::vector<std::recursive_mutex> mtx1;
     mutable std::vector<std::recursive_mutex> mtx2;
-    std::recursive_mutex resize_mtx;
+    mutable std::recursive_mutex resize_mtx;
     std::atomic<bool> needResize = false;
 
     myhash::StdHash1<Key> hash1;
     myhash::StdHash2<Key> hash2;
 
+    stats_block stats_;
+
     inline static size_t MAX_RELOCATIONS = 16;
     inline static size_t PROBE_SIZE = 4;
     inline static size_t THRESHOLD = 2;
     inline static size_t LIMIT = 10;
+
+    // Smallest range of old buckets worth handing to another thread in resize
+    inline static constexpr size_t SPLIT_CHUNK = 4096;
+    // Buckets scanned per task in erase_if
+    inline static constexpr size_t SCAN_CHUNK = 4096;
 };
 
 } // namespace cuckoo
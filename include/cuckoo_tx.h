@@ -1,25 +1,58 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <mutex>
+#include <span>
+#include <stdexcept>
+#include <type_traits>
 #include <vector>
-#include <optional>
+#include "bucket_allocator.h"
+#include "cuckoo_stats.h"
 #include "hashes.h"
+#include "op_gate.h"
+#include "slot_traits.h"
+#include "task_pool.h"
 
 namespace cuckoo {
 
-template<myhash::HashableAndEquatable Key>
+// One operation of a cuckoo_tx::run_batch() call.
+enum class tx_op_kind { add, remove, contains };
+
+template<typename Key>
+struct tx_op {
+    tx_op_kind kind;
+    Key key;
+};
+
+// Slots picks how empty slots are marked (see slot_traits.h).
+//
+// Keys are copied and compared inside transactions, so they must be
+// trivially copyable: libstdc++ types such as std::string are not
+// transaction-safe. Large keys are moved, and compared in place.
+template<myhash::HashableAndEquatable Key, typename Alloc = bucket_allocator<Key>,
+         typename Slots = optional_slots<Key>>
 class cuckoo_tx {
+    static_assert(std::is_trivially_copyable_v<Key>,
+                  "cuckoo_tx: keys are copied inside transactions");
+
 public:
-    explicit cuckoo_tx(size_t cap = 16)
+    using key_type = Key;
+
+    explicit cuckoo_tx(size_t cap = 16, const Alloc& alloc = Alloc())
         : capacity(next_power_of_two(cap)),
-          size_(0){
+          size_(0),
+          alloc_(alloc){
 
-      table1 = new std::optional<Key>[capacity];
-      table2 = new std::optional<Key>[capacity];
+      table1 = new_slots(capacity, alloc_);
+      table2 = new_slots(capacity, alloc_);
     }
 
     ~cuckoo_tx() {
-      delete[] table1;
-      delete[] table2;
+      free_slots(table1, capacity, alloc_);
+      free_slots(table2, capacity, alloc_);
+      free_slots(retired1, retired_capacity, retired_alloc);
+      free_slots(retired2, retired_capacity, retired_alloc);
     }
 
     static void configure(size_t max_relocations) 
@@ -30,6 +63,9 @@ public:
     template<std::convertible_to<Key> K>
     bool add(K&& keyParam){
       Key key = std::forward<K>(keyParam);
+      if(Slots::reserved(key)){
+        throw std::invalid_argument("cuckoo_tx: key is reserved for empty slots");
+      }
       
       if(contains(key)){
         return false;
@@ -38,29 +74,41 @@ public:
       for (size_t i = 0; i < MAX_RELOCATIONS; ++i) {
         bool tm_success = false;
         bool done = false;
-        size_t b1 = bucket1(key);
+        // hash outside the transaction, but take the bucket inside it so a
+        // resize that completes in between cannot leave it stale
+        size_t h1 = hash1(key);
         while(!tm_success){
-          if(resizing){
+          if(resizing || !gate.enter()){
+            stats_.tx_deferrals.add();
             std::this_thread::yield();
             continue; // resizing, try again later
           }
-          __transaction_atomic{
-            // auto& slot = table1[b1];
-            if (!table1[b1]) {
-              table1[b1] = key;
-              ++size_;
-              done = true;
-              // return true;
-            } else {
-              std::swap(*(table1[b1]), key);
-            }
-            if(resizing){
-              __transaction_cancel;
+          atomically([&]{
+            note_tx_attempt(stats_.tx_attempts);
+            // check before writing: resize() must never see this one's
+            // in-place writes. A guard rather than __transaction_cancel,
+            // which libitm does not honour once it has fallen back to
+            // serial mode.
+            if(!resizing){
+              size_t b1 = h1 & (capacity - 1);
+              if (Slots::is_empty(table1[b1])) {
+                table1[b1] = std::move(key);
+                ++size_;
+                done = true;
+                // return true;
+              } else {
+                std::swap(Slots::key(table1[b1]), key);
+              }
+              tm_success = true;
             }
-            tm_success = true;
-          }
+          });
+          gate.leave();
+        }
+        stats_.tx_commits.add();
+        if(done){
+          stats_.record_insert(2 * i);
+          return true;
         }
-        if(done) return true;
         // auto& slot1 = table1[bucket1(key)];
         // if (!slot1) {
         //   slot1.emplace(std::move(key));
@@ -72,29 +120,41 @@ public:
 
         tm_success = false;
         done = false;
-        size_t b2 = bucket2(key);
+        // hash outside the transaction, but take the bucket inside it so a
+        // resize that completes in between cannot leave it stale
+        size_t h2 = hash2(key);
         while(!tm_success){
-          if(resizing){
+          if(resizing || !gate.enter()){
+            stats_.tx_deferrals.add();
             std::this_thread::yield();
             continue; // resizing, try again later
           }
-          __transaction_atomic{
-            // auto& slot = table1[b1];
-            if (!table2[b2]) {
-              table2[b2] = key;
-              ++size_;
-              done = true;
-              // return true;
-            } else {
-              std::swap(*(table2[b2]), key);
-            }
-            if(resizing){
-              __transaction_cancel;
+          atomically([&]{
+            note_tx_attempt(stats_.tx_attempts);
+            // check before writing: resize() must never see this one's
+            // in-place writes. A guard rather than __transaction_cancel,
+            // which libitm does not honour once it has fallen back to
+            // serial mode.
+            if(!resizing){
+              size_t b2 = h2 & (capacity - 1);
+              if (Slots::is_empty(table2[b2])) {
+                table2[b2] = std::move(key);
+                ++size_;
+                done = true;
+                // return true;
+              } else {
+                std::swap(Slots::key(table2[b2]), key);
+              }
+              tm_success = true;
             }
-            tm_success = true;
-          }
+          });
+          gate.leave();
+        }
+        stats_.tx_commits.add();
+        if(done){
+          stats_.record_insert(2 * i + 1);
+          return true;
         }
-        if(done) return true;
 
         // auto& slot2 = table2[bucket2(key)];
         // if (!slot2) {
@@ -105,64 +165,219 @@ public:
         //   std::swap(*slot2, key);
         // }
       }
+      stats_.relocation_failures.add();
       resize();
       return add(std::move(key));
     }
 
     bool contains(const Key& key) const{
+      if(Slots::reserved(key)) return false;
       bool tm_success = false;
-      std::optional<Key> v1, v2;
+      bool found = false;
+      size_t h1 = hash1(key);
+      size_t h2 = hash2(key);
       while(!tm_success){
-        if(resizing){
+        if(resizing || !gate.enter()){
+          stats_.tx_deferrals.add();
           std::this_thread::yield();
           continue;
         }
-        size_t b1 = bucket1(key);
-        size_t b2 = bucket2(key);
-        __transaction_atomic{
+        atomically([&]{
+          note_tx_attempt(stats_.tx_attempts);
           if(!resizing){
-            v1 = table1[b1];
-            v2 = table2[b2];
+            // compared in place rather than copied out: a key can be large
+            found = find_slot(key, h1, h2) != nullptr;
             tm_success = true;
           }
-        }
+        });
+        gate.leave();
       }
-      return (v1 && *v1 == key) || (v2 && *v2 == key);
+      stats_.tx_commits.add();
+      return found;
     }
 
     bool remove(const Key& key){
-      size_t h1 = bucket1(key);
-      size_t h2 = bucket2(key);
+      if(Slots::reserved(key)) return false;
+      size_t h1 = hash1(key);
+      size_t h2 = hash2(key);
       bool removed = false;
       bool tm_success = false;
       while(!tm_success){
-        if(resizing){
+        if(resizing || !gate.enter()){
+          stats_.tx_deferrals.add();
           std::this_thread::yield();
           continue; // resizing, try again later
         }
-        __transaction_atomic {
-          if(resizing)
-            __transaction_cancel;
-          if(table1[h1] == key){
-            table1[h1] = std::nullopt;
-            removed = true;
-            --size_;
+        atomically([&]{
+          note_tx_attempt(stats_.tx_attempts);
+          if(!resizing){
+            size_t b1 = h1 & (capacity - 1);
+            size_t b2 = h2 & (capacity - 1);
+            if(Slots::holds(table1[b1], key)){
+              table1[b1] = Slots::empty();
+              removed = true;
+              --size_;
+            }
+            else if(Slots::holds(table2[b2], key)){
+              table2[b2] = Slots::empty();
+              removed = true;
+              --size_;
+            }
+            tm_success = true;
           }
-          else if(table2[h2] == key){
-            table2[h2] = std::nullopt;
-            removed = true;
-            --size_;
+        });
+        gate.leave();
+      }
+      stats_.tx_commits.add();
+      return removed;
+    }
+
+    // Runs ops in order, results[i] being what add/remove/contains would
+    // have returned for ops[i]. Consecutive ops are grouped into one
+    // transaction each, so libitm's fixed cost per transaction is paid once
+    // per group. An add places its key with the whole displacement chain in
+    // that transaction. If the chain does not end in a free slot within
+    // MAX_RELOCATIONS moves, the group commits the ops before it and the add
+    // runs on its own, where it may resize.
+    //
+    // Groups start at batch_size() ops. A group that commits on its first
+    // attempt lets the next one grow by one, up to MAX_BATCH; one that was
+    // aborted halves it, so the size settles where conflicts stay rare.
+    void run_batch(std::span<const tx_op<Key>> ops, std::span<bool> results){
+      for (const tx_op<Key>& op : ops){
+        if (op.kind == tx_op_kind::add && Slots::reserved(op.key))
+          throw std::invalid_argument("cuckoo_tx: key is reserved for empty slots");
+      }
+      std::vector<size_t> h1(MAX_BATCH), h2(MAX_BATCH), path(MAX_BATCH);
+      for (size_t first = 0; first < ops.size(); ){
+        size_t n = std::min(ops.size() - first, batch_.load(std::memory_order_relaxed));
+        for (size_t k = 0; k < n; k++){
+          h1[k] = hash1(ops[first + k].key);
+          h2[k] = hash2(ops[first + k].key);
+        }
+
+        size_t attempts = 0;
+        size_t ran = 0;
+        bool deferred = false;
+        bool tm_success = false;
+        while(!tm_success){
+          if(resizing || !gate.enter()){
+            stats_.tx_deferrals.add();
+            std::this_thread::yield();
+            continue; // resizing, try again later
           }
-          tm_success = true;
+          atomically([&]{
+            note_tx_attempt(stats_.tx_attempts);
+            count_attempt(attempts);
+            if(!resizing){
+              // both are reset here: an aborted attempt may leave them set
+              deferred = false;
+              for (ran = 0; ran < n && !deferred; ran++){
+                const tx_op<Key>& op = ops[first + ran];
+                path[ran] = 0;
+                if (op.kind == tx_op_kind::contains)
+                  results[first + ran] = find_slot(op.key, h1[ran], h2[ran]) != nullptr;
+                else if (op.kind == tx_op_kind::remove)
+                  results[first + ran] = remove_in_tx(op.key, h1[ran], h2[ran]);
+                else
+                  results[first + ran] = add_in_tx(op.key, h1[ran], h2[ran], path[ran], deferred);
+              }
+              tm_success = true;
+            }
+          });
+          gate.leave();
+        }
+        stats_.tx_commits.add();
+        adapt_batch(attempts);
+
+        for (size_t k = 0; k < ran; k++){
+          if (ops[first + k].kind == tx_op_kind::add && results[first + k] && !(deferred && k + 1 == ran))
+            stats_.record_insert(path[k]);
         }
+        if (deferred) {
+          // the last op that ran is the add whose chain did not fit
+          stats_.relocation_failures.add();
+          results[first + ran - 1] = add(ops[first + ran - 1].key);
+        }
+        first += ran;
       }
-      return removed;
+    }
+
+    // Ops per transaction run_batch() currently aims for.
+    size_t batch_size() const {
+      return batch_.load(std::memory_order_relaxed);
+    }
+
+    // Removes every key for which pred(key) is true and returns how many
+    // went. Adds displace keys one transaction at a time, so the table is
+    // held still the way resize() holds it: the flag defers other operations
+    // and resize_mtx keeps the arrays in place. Ranges of slots are then
+    // scanned on the task pool a batch at a time. One transaction copies the
+    // batch out, pred runs outside it (it need not be transaction-safe, and
+    // may be called from several threads at once), and a second transaction
+    // clears the slots that still hold the key it was shown.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      atomically([&]{
+        resizing = true;
+      });
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      // a resize() we waited for clears the flag on its way out
+      atomically([&]{
+        resizing = true;
+      });
+      gate.close();
+      std::atomic<size_t> erased{0};
+      parallel_for(0, capacity, SPLIT_CHUNK, [&](size_t begin, size_t end){
+        size_t n = 0;
+        for (size_t b = begin; b < end; b += SPLIT_BATCH){
+          size_t batch_end = std::min(end, b + SPLIT_BATCH);
+          n += erase_batch(table1, b, batch_end, pred);
+          n += erase_batch(table2, b, batch_end, pred);
+        }
+        atomically([&]{
+          size_ -= n;
+        });
+        erased += n;
+      });
+      gate.open();
+      // a resize() that queued up behind us finds the flag clear and leaves
+      // it to the add that needs the room to try again
+      atomically([&]{
+        resizing = false;
+      });
+      return erased;
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
     }
 
     size_t size() const { 
       return size_; 
     }
 
+    size_t bucket_count() const {
+      return capacity;
+    }
+
+    cuckoo_stats stats() const {
+      return stats_.snapshot();
+    }
+
+    // Bytes allocated for the table. The arrays the last resize replaced
+    // are kept until the next one (see resize()) and count as overflow.
+    cuckoo_memory memory_usage() const {
+      std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
+      cuckoo_memory m;
+      m.table_bytes = 2 * capacity * sizeof(slot_type);
+      m.lock_bytes = sizeof(op_gate) + sizeof(std::recursive_mutex);
+      m.overflow_bytes = 2 * retired_capacity * sizeof(slot_type);
+      return m;
+    }
+
     void populate(std::vector<Key>& values){
       for(Key& key : values){
         add(key);
@@ -171,65 +386,200 @@ public:
     }
 
 private:
-    void resize(){
-      if (capacity > (1 << 25)) throw std::runtime_error("Hash table too large. Check hash function");
+    friend struct bench_access; // tests/bench_micro.cpp
+
+    using slot_type = typename Slots::slot_type;
+    using slot_alloc = typename std::allocator_traits<Alloc>::template rebind_alloc<slot_type>;
+
+    // Runs body as one atomic transaction. The transaction's start returns
+    // twice, like setjmp, so it is kept in a frame of its own: the caller's
+    // locals that body touches are captured by reference and stay in memory,
+    // rather than in registers the restart could leave stale (-Wclobbered).
+    template<typename F>
+    __attribute__((noinline)) static void atomically(F&& body){
       __transaction_atomic {
-        resizing = true;
+        body();
       }
+    }
+
+    void resize(){
+      atomically([&]{
+        resizing = true;
+      });
+      stat_timer wait;
       std::unique_lock<std::recursive_mutex> resize_lock(resize_mtx);
-      if(!resizing) return;
+      stats_.resize_wait_ns.add(wait.elapsed_ns());
+      // read and clear the flag transactionally: a plain read could see
+      // another thread's uncommitted write, which it may still roll back
+      bool need_resize;
+      atomically([&]{
+        need_resize = resizing;
+      });
+      if(!need_resize) return;
+      stat_timer timer;
       resize_lvl++;
-      capacity *= 2;
-      
-      std::optional<Key>* old_table1 = new std::optional<Key>[capacity];
-      std::optional<Key>* old_table2 = new std::optional<Key>[capacity];
+      size_t old_capacity = capacity;
+      slot_type* old_table1 = table1;
+      slot_type* old_table2 = table2;
+      slot_alloc alloc = next_generation(alloc_);
+      slot_type* new_table1 = new_slots(2 * old_capacity, alloc);
+      slot_type* new_table2 = new_slots(2 * old_capacity, alloc);
 
-      std::swap(old_table1, table1);
-      std::swap(old_table2, table2);
-      
-      // table1.assign(capacity, std::nullopt);
-      // table2.assign(capacity, std::nullopt);
-      
-      size_ = 0; //updated by add
-      
-      for (int i = capacity / 2 - 1; i >= 0; i--){
-        std::optional<Key>& slot = old_table1[i];
-        if (slot) priv_add(std::move(*slot));
-      }
-      for (int i = capacity / 2 - 1; i >= 0; i--){
-        std::optional<Key>& slot = old_table2[i];
-        if (slot) priv_add(std::move(*slot));
-      }
+      gate.close();
+      split(old_table1, old_table2, new_table1, new_table2, old_capacity);
+      atomically([&]{
+        table1 = new_table1;
+        table2 = new_table2;
+        capacity = 2 * old_capacity;
+      });
+      // a transaction that started before the flag was set may still be
+      // reading the old arrays until it aborts, so they are freed one
+      // resize later
+      free_slots(retired1, retired_capacity, retired_alloc);
+      free_slots(retired2, retired_capacity, retired_alloc);
+      retired1 = old_table1;
+      retired2 = old_table2;
+      retired_capacity = old_capacity;
+      retired_alloc = alloc_;
+      alloc_ = alloc;
       resize_lvl--;
-      if(resize_lvl == 0)
-        resizing = false;
+      if(resize_lvl == 0){
+        gate.open();
+        atomically([&]{
+          resizing = false;
+        });
+      }
+      stats_.resizes.add();
+      stats_.resize_ns.add(timer.elapsed_ns());
     }
 
-    template<std::convertible_to<Key> K>
-    bool priv_add(K&& keyParam){
-      Key key = std::forward<K>(keyParam);
-
-      for (size_t i = 0; i < MAX_RELOCATIONS; ++i) {
-        auto& slot1 = table1[bucket1(key)];
-        if (!slot1) {
-          slot1.emplace(std::move(key));
-          ++size_;
-          return true;
-        } else {
-          std::swap(*slot1, key);
+    // Capacity doubles and buckets are hash & (capacity - 1), so the key in
+    // old slot b can only land in b or b + old_capacity. Each new slot is fed
+    // by exactly one old slot, so ranges of old slots are split on several
+    // threads with no lookups or displacement. The old slots are read in
+    // small transactions: a transaction that read the flag before it was set
+    // may still be writing them in place, and must commit or roll back first.
+    void split(slot_type* old_table1, slot_type* old_table2,
+               slot_type* new_table1, slot_type* new_table2,
+               size_t old_capacity){
+      parallel_for(0, old_capacity, SPLIT_CHUNK, [&](size_t begin, size_t end){
+        for (size_t b = begin; b < end; b += SPLIT_BATCH){
+          size_t batch_end = std::min(end, b + SPLIT_BATCH);
+          atomically([&]{
+            for (size_t i = b; i < batch_end; i++){
+              if (!Slots::is_empty(old_table1[i]))
+                new_table1[i | (hash1(Slots::key(old_table1[i])) & old_capacity)] = std::move(old_table1[i]);
+              if (!Slots::is_empty(old_table2[i]))
+                new_table2[i | (hash2(Slots::key(old_table2[i])) & old_capacity)] = std::move(old_table2[i]);
+            }
+          });
         }
+      });
+    }
 
-        auto& slot2 = table2[bucket2(key)];
-        if (!slot2) {
-          slot2.emplace(std::move(key));
-          ++size_;
-          return true;
-        } else {
-          std::swap(*slot2, key);
+    // ---- bodies of run_batch() and contains(), called inside their
+    // transactions ----
+
+    slot_type* find_slot(const Key& key, size_t h1, size_t h2) const{
+      if (Slots::reserved(key)) return nullptr;
+      slot_type& s1 = table1[h1 & (capacity - 1)];
+      if (Slots::holds(s1, key)) return &s1;
+      slot_type& s2 = table2[h2 & (capacity - 1)];
+      if (Slots::holds(s2, key)) return &s2;
+      return nullptr;
+    }
+
+    bool remove_in_tx(const Key& key, size_t h1, size_t h2){
+      slot_type* s = find_slot(key, h1, h2);
+      if (!s) return false;
+      *s = Slots::empty();
+      --size_;
+      return true;
+    }
+
+    // add()'s displacement chain (table1, table2, table1, ...) traced
+    // without writing. If it reaches a free slot, every key on it moves one
+    // step along and key takes the first slot. A chain that runs out of
+    // moves or comes back to a slot it already passed sets deferred_add and
+    // writes nothing.
+    bool add_in_tx(const Key& key, size_t h1, size_t h2, size_t& path_len, bool& deferred_add){
+      if (find_slot(key, h1, h2) != nullptr) return false;
+      slot_type* chain[2 * MAX_CHAIN + 1];
+      size_t limit = std::min<size_t>(2 * MAX_RELOCATIONS, 2 * MAX_CHAIN);
+      size_t mask = capacity - 1;
+      chain[0] = &table1[h1 & mask];
+      size_t len = 0;
+      while (!Slots::is_empty(*chain[len])) {
+        if (len == limit) { deferred_add = true; return false; }
+        const Key& y = Slots::key(*chain[len]);
+        // chain[len] is in table1 at even steps, so y moves to table2
+        slot_type* next = (len % 2 == 0) ? &table2[hash2(y) & mask]
+                                         : &table1[hash1(y) & mask];
+        for (size_t i = 0; i <= len; i++) {
+          if (chain[i] == next) { deferred_add = true; return false; }
         }
+        chain[++len] = next;
       }
-      resize();
-      return priv_add(std::move(key));
+      for (size_t i = len; i > 0; i--) *chain[i] = std::move(*chain[i - 1]);
+      *chain[0] = key;
+      ++size_;
+      path_len = len;
+      return true;
+    }
+
+    // transaction_pure, like note_tx_attempt: counts the attempts that
+    // libitm rolls back too.
+    __attribute__((transaction_pure)) static void count_attempt(size_t& attempts){
+      ++attempts;
+    }
+
+    void adapt_batch(size_t attempts){
+      size_t b = batch_.load(std::memory_order_relaxed);
+      size_t next = (attempts <= 1) ? std::min(MAX_BATCH, b + 1) : std::max<size_t>(1, b / 2);
+      if (next != b) batch_.compare_exchange_strong(b, next, std::memory_order_relaxed);
+    }
+
+    template<typename Pred>
+    size_t erase_batch(slot_type* table, size_t begin, size_t end, Pred& pred){
+      slot_type seen[SPLIT_BATCH];
+      bool drop[SPLIT_BATCH];
+      size_t n = 0;
+      atomically([&]{
+        note_tx_attempt(stats_.tx_attempts);
+        for (size_t i = begin; i < end; i++)
+          seen[i - begin] = table[i];
+      });
+      stats_.tx_commits.add();
+      bool any = false;
+      for (size_t i = begin; i < end; i++){
+        drop[i - begin] = !Slots::is_empty(seen[i - begin]) && pred(Slots::key(seen[i - begin]));
+        any |= drop[i - begin];
+      }
+      if (!any) return 0;
+      atomically([&]{
+        note_tx_attempt(stats_.tx_attempts);
+        n = 0;
+        for (size_t i = begin; i < end; i++){
+          if (drop[i - begin] && table[i] == seen[i - begin]){
+            table[i] = Slots::empty();
+            n++;
+          }
+        }
+      });
+      stats_.tx_commits.add();
+      return n;
+    }
+
+    static slot_type* new_slots(size_t n, slot_alloc& alloc){
+      slot_type* slots = alloc.allocate(n);
+      std::uninitialized_fill_n(slots, n, Slots::empty());
+      return slots;
+    }
+
+    static void free_slots(slot_type* slots, size_t n, slot_alloc& alloc){
+      if (!slots) return;
+      std::destroy_n(slots, n);
+      alloc.deallocate(slots, n);
     }
 
     size_t next_power_of_two(size_t n){
@@ -252,16 +602,39 @@ private:
 
     size_t capacity; // must be power of two
     size_t size_;
-    std::optional<Key>* table1;
-    std::optional<Key>* table2;
-    std::recursive_mutex resize_mtx;
+    slot_type* table1;
+    slot_type* table2;
+    slot_alloc alloc_;
+    slot_type* retired1 = nullptr; // arrays replaced by the last resize
+    slot_type* retired2 = nullptr;
+    size_t retired_capacity = 0;
+    slot_alloc retired_alloc;
+    mutable std::recursive_mutex resize_mtx;
     bool resizing = false;
     int resize_lvl = 0;
+    std::atomic<size_t> batch_{INITIAL_BATCH}; // run_batch() group size
+    // The flag alone does not hold the table still: libitm can still commit
+    // a transaction that read it clear after the transaction that set it.
+    // Every operation transaction therefore also runs inside the gate, which
+    // resize() and erase_if() close before touching the arrays.
+    op_gate gate;
+
+    mutable stats_block stats_;
 
-    myhash::StdHash1<std::optional<Key>> hash1;
-    myhash::StdHash2<std::optional<Key>> hash2;
+    myhash::StdHash1<Key> hash1;
+    myhash::StdHash2<Key> hash2;
 
     inline static size_t MAX_RELOCATIONS = 16;
+
+    // Smallest range of old slots worth handing to another thread in resize
+    inline static constexpr size_t SPLIT_CHUNK = 4096;
+    // Old slots copied per transaction in split()
+    inline static constexpr size_t SPLIT_BATCH = 64;
+    // Bounds on the ops per run_batch() transaction
+    inline static constexpr size_t INITIAL_BATCH = 8;
+    inline static constexpr size_t MAX_BATCH = 64;
+    // Longest displacement chain run_batch() traces in a transaction
+    inline static constexpr size_t MAX_CHAIN = 32;
 };
 
 } // namespace cuckoo
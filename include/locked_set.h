@@ -0,0 +1,109 @@
+#pragma once
+#include <functional>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <type_traits>
+#include <unordered_set>
+#include <vector>
+#include "cuckoo_stats.h"
+#include "hashes.h"
+
+namespace cuckoo {
+
+// Baseline engine: one std::unordered_set behind one lock, the engine the
+// cuckoo tables replace. With the default std::shared_mutex lookups share
+// the lock and only writes take it alone; Mutex = std::mutex makes every
+// operation exclusive. A rehash blocks every other operation until it is
+// done. There is nothing to configure().
+template<myhash::HashableAndEquatable Key, typename Mutex = std::shared_mutex>
+class locked_set {
+    using read_lock = std::conditional_t<requires(Mutex& m) { m.lock_shared(); },
+                                         std::shared_lock<Mutex>, std::unique_lock<Mutex>>;
+    using write_lock = std::unique_lock<Mutex>;
+
+public:
+    using key_type = Key;
+
+    // room for capacity keys before the first rehash
+    explicit locked_set(size_t capacity = 16){
+      set.reserve(capacity);
+    }
+
+    template<std::convertible_to<Key> K>
+    bool add(K&& keyParam){
+      Key key = std::forward<K>(keyParam);
+      write_lock lock(mtx);
+      return set.insert(std::move(key)).second;
+    }
+
+    bool contains(const Key& key) const{
+      read_lock lock(mtx);
+      return set.count(key) > 0;
+    }
+
+    // found[i] = contains(keys[i]), all under one read lock.
+    void contains_batch(std::span<const Key> keys, std::span<bool> found) const{
+      read_lock lock(mtx);
+      for (size_t i = 0; i < keys.size(); ++i) found[i] = set.count(keys[i]) > 0;
+    }
+
+    bool remove(const Key& key){
+      write_lock lock(mtx);
+      return set.erase(key) > 0;
+    }
+
+    // Removes every key for which pred(key) is true and returns how many
+    // went. pred is called under the write lock, from this thread only.
+    template<typename Pred>
+    size_t erase_if(Pred pred){
+      write_lock lock(mtx);
+      return std::erase_if(set, pred);
+    }
+
+    // Keeps only the keys for which pred(key) is true.
+    template<typename Pred>
+    size_t retain(Pred pred){
+      return erase_if([&](const Key& key){ return !pred(key); });
+    }
+
+    size_t size() const {
+      read_lock lock(mtx);
+      return set.size();
+    }
+
+    size_t bucket_count() const {
+      read_lock lock(mtx);
+      return set.bucket_count();
+    }
+
+    // No displacements, relocations or cuckoo resizes: all zero.
+    cuckoo_stats stats() const {
+      return {};
+    }
+
+    // The bucket array of node pointers, and one heap block per key for its
+    // node: the next pointer, the key and a cached hash (libstdc++ leaves the
+    // hash out for integer keys, which glibc's 32-byte minimum chunk hides).
+    cuckoo_memory memory_usage() const {
+      read_lock lock(mtx);
+      cuckoo_memory m;
+      m.table_bytes = set.bucket_count() * sizeof(void*);
+      m.lock_bytes = sizeof(Mutex);
+      m.overflow_bytes = set.size() * heap_block_bytes(sizeof(void*) + sizeof(Key) + sizeof(size_t));
+      return m;
+    }
+
+    void populate(std::vector<Key>& values){
+      for(Key& key : values){
+        add(key);
+      }
+      return;
+    }
+
+private:
+    mutable Mutex mtx;
+    std::unordered_set<Key> set;
+};
+
+} // namespace cuckoo
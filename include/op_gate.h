@@ -0,0 +1,61 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+namespace cuckoo {
+
+// Keeps operations out of a table while a table-wide job (a resize, a bulk
+// scan, a change of layout) rearranges it. Each operation runs between
+// enter() and leave(), counted per slot outside any lock or transaction,
+// and close() waits for the count to drain. Threads are spread over SLOTS
+// counters, one cache line each, so operations on different threads do not
+// write the same line.
+//
+// enter() never blocks: it fails while the gate is closed and the caller
+// retries, so the thread that closed the gate cannot wait on one parked in
+// it.
+class op_gate {
+public:
+    bool enter() const {
+      std::atomic<uint32_t>& active = slots[index()].active;
+      active.fetch_add(1);
+      if (closed.load()) {
+        active.fetch_sub(1);
+        return false;
+      }
+      return true;
+    }
+
+    void leave() const {
+      slots[index()].active.fetch_sub(1);
+    }
+
+    void close() {
+      closed.store(true);
+      for (slot& s : slots)
+        while (s.active.load() != 0) std::this_thread::yield();
+    }
+
+    void open() {
+      closed.store(false);
+    }
+
+private:
+    static size_t index() {
+      static std::atomic<size_t> next_index{0};
+      thread_local size_t index = next_index.fetch_add(1) % SLOTS;
+      return index;
+    }
+
+    static constexpr size_t SLOTS = 16;
+
+    struct alignas(64) slot {
+      std::atomic<uint32_t> active{0};
+    };
+    mutable slot slots[SLOTS];
+    std::atomic<bool> closed{false};
+};
+
+} // namespace cuckoo
@@ -0,0 +1,49 @@
+#pragma once
+#include <optional>
+
+namespace cuckoo {
+
+// How cuckoo_seq and cuckoo_tx mark empty slots. A traits type names the
+// slot type and how to tell an empty slot from a key:
+//
+//   slot_type            what the slot arrays hold
+//   empty()              the value of an empty slot
+//   is_empty(slot)
+//   key(slot)            the key in a slot that is not empty
+//   holds(slot, key)     slot holds key; key is never reserved
+//   reserved(key)        key cannot be stored
+//
+// Each key has exactly two slots and a remove just empties its slot, so no
+// tombstone is needed.
+
+// The default: every slot is a std::optional<Key>, so any key can be
+// stored, at the cost of the engaged flag (and its padding) per slot.
+template<typename Key>
+struct optional_slots {
+    using slot_type = std::optional<Key>;
+
+    static slot_type empty() { return std::nullopt; }
+    static bool is_empty(const slot_type& s) { return !s; }
+    static const Key& key(const slot_type& s) { return *s; }
+    static Key& key(slot_type& s) { return *s; }
+    static bool holds(const slot_type& s, const Key& k) { return s == k; }
+    static bool reserved(const Key&) { return false; }
+};
+
+// Slots hold raw keys, and EMPTY, which the table then cannot store, marks
+// an empty one: an int table takes 4 bytes per slot instead of 8, and an
+// empty check is a compare against a constant. add() throws
+// std::invalid_argument for EMPTY; contains() and remove() return false.
+template<typename Key, Key EMPTY>
+struct empty_key {
+    using slot_type = Key;
+
+    static slot_type empty() { return EMPTY; }
+    static bool is_empty(const slot_type& s) { return s == EMPTY; }
+    static const Key& key(const slot_type& s) { return s; }
+    static Key& key(slot_type& s) { return s; }
+    static bool holds(const slot_type& s, const Key& k) { return s == k; }
+    static bool reserved(const Key& k) { return k == EMPTY; }
+};
+
+} // namespace cuckoo
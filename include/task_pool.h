@@ -0,0 +1,203 @@
+#pragma once
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace cuckoo {
+
+// Work-stealing pool for table-wide jobs over bucket ranges (resize splits,
+// bulk scans). parallel_for() hands the caller the whole range; whoever runs a
+// task keeps halving it, pushing the upper half onto its own deque, until what
+// is left fits in one grain. Idle threads steal the oldest, and so largest,
+// halves from the other deques. The calling thread runs tasks too while it
+// waits, so a pool of N threads keeps N - 1 workers and no thread is spawned
+// per call. It only runs tasks of its own job, though: another caller's may
+// need locks this one holds, or expect it to have left the table it is in.
+class task_pool {
+public:
+    explicit task_pool(size_t threads = std::thread::hardware_concurrency())
+        : queues(std::max<size_t>(1, threads)) {
+      // the last queue is shared by threads from outside the pool
+      for (size_t i = 0; i + 1 < queues.size(); ++i)
+        workers.emplace_back([this, i] { worker_loop(i); });
+    }
+
+    ~task_pool() {
+      {
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        stopping = true;
+      }
+      sleep_cv.notify_all();
+      for (std::thread& w : workers) w.join();
+    }
+
+    task_pool(const task_pool&) = delete;
+    task_pool& operator=(const task_pool&) = delete;
+
+    // Pool used by the engines, started on first use.
+    static task_pool& shared() {
+      static task_pool pool;
+      return pool;
+    }
+
+    size_t concurrency() const { return workers.size() + 1; }
+
+    // Calls fn(b, e) on disjoint ranges covering [begin, end), none longer
+    // than grain, and returns once all have run. The first exception thrown
+    // by fn is rethrown here.
+    template<typename F>
+    void parallel_for(size_t begin, size_t end, size_t grain, F&& fn) {
+      if (end <= begin) return;
+      grain = std::max<size_t>(1, grain);
+      if (workers.empty() || end - begin <= grain) {
+        for (size_t b = begin; b < end; b += grain) fn(b, std::min(end, b + grain));
+        return;
+      }
+
+      job j;
+      j.fn = const_cast<void*>(static_cast<const void*>(std::addressof(fn)));
+      j.call = [](void* f, size_t b, size_t e) {
+        (*static_cast<std::remove_reference_t<F>*>(f))(b, e);
+      };
+      j.grain = grain;
+      run({&j, begin, end});
+      while (j.pending.load(std::memory_order_acquire) != 0) {
+        if (!run_one(&j)) std::this_thread::yield();
+      }
+      if (j.error) std::rethrow_exception(j.error);
+    }
+
+private:
+    struct job {
+      void* fn;
+      void (*call)(void*, size_t, size_t);
+      size_t grain;
+      std::atomic<size_t> pending{1}; // tasks pushed or running, root included
+      std::mutex error_mtx;
+      std::exception_ptr error;
+    };
+
+    struct task {
+      job* j;
+      size_t begin;
+      size_t end;
+    };
+
+    struct queue {
+      std::mutex mtx;
+      std::deque<task> tasks;
+    };
+
+    size_t self() const {
+      return tl_pool == this ? tl_index : queues.size() - 1;
+    }
+
+    void run(task t) {
+      queue& q = queues[self()];
+      while (t.end - t.begin > t.j->grain) {
+        size_t mid = t.begin + (t.end - t.begin) / 2;
+        t.j->pending.fetch_add(1, std::memory_order_relaxed);
+        push(q, {t.j, mid, t.end});
+        t.end = mid;
+      }
+      try {
+        t.j->call(t.j->fn, t.begin, t.end);
+      } catch (...) {
+        std::unique_lock<std::mutex> lock(t.j->error_mtx);
+        if (!t.j->error) t.j->error = std::current_exception();
+      }
+      t.j->pending.fetch_sub(1, std::memory_order_release);
+    }
+
+    void push(queue& q, const task& t) {
+      {
+        std::unique_lock<std::mutex> lock(q.mtx);
+        q.tasks.push_back(t);
+      }
+      queued.fetch_add(1);
+      if (sleepers.load() > 0) {
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        sleep_cv.notify_one();
+      }
+    }
+
+    // Runs one task, of job only if that is set: the newest from our own
+    // deque, else the oldest from another. Returns false if none was found.
+    bool run_one(const job* only = nullptr) {
+      size_t me = self();
+      task t;
+      if (pop(queues[me], t, false, only)) {
+        run(t);
+        return true;
+      }
+      for (size_t k = 1; k < queues.size(); ++k) {
+        if (pop(queues[(me + k) % queues.size()], t, true, only)) {
+          run(t);
+          return true;
+        }
+      }
+      return false;
+    }
+
+    // Takes the oldest (steal) or newest task of q, skipping other jobs'
+    // when only is set; threads from outside the pool share a deque.
+    bool pop(queue& q, task& t, bool steal, const job* only) {
+      std::unique_lock<std::mutex> lock(q.mtx);
+      auto mine = [only](const task& c) { return !only || c.j == only; };
+      if (steal) {
+        auto it = std::find_if(q.tasks.begin(), q.tasks.end(), mine);
+        if (it == q.tasks.end()) return false;
+        t = *it;
+        q.tasks.erase(it);
+      } else {
+        auto it = std::find_if(q.tasks.rbegin(), q.tasks.rend(), mine);
+        if (it == q.tasks.rend()) return false;
+        t = *it;
+        q.tasks.erase(std::next(it).base());
+      }
+      queued.fetch_sub(1);
+      return true;
+    }
+
+    void worker_loop(size_t index) {
+      tl_pool = this;
+      tl_index = index;
+      for (;;) {
+        if (run_one()) continue;
+        std::unique_lock<std::mutex> lock(sleep_mtx);
+        sleepers.fetch_add(1);
+        sleep_cv.wait(lock, [this] { return stopping || queued.load() > 0; });
+        sleepers.fetch_sub(1);
+        if (stopping) return;
+      }
+    }
+
+    std::vector<queue> queues;
+    std::vector<std::thread> workers;
+
+    std::atomic<size_t> queued{0};
+    std::atomic<size_t> sleepers{0};
+    std::mutex sleep_mtx;
+    std::condition_variable sleep_cv;
+    bool stopping = false;
+
+    inline static thread_local const task_pool* tl_pool = nullptr;
+    inline static thread_local size_t tl_index = 0;
+};
+
+// parallel_for on the shared pool.
+template<typename F>
+void parallel_for(size_t begin, size_t end, size_t grain, F&& fn) {
+    task_pool::shared().parallel_for(begin, end, grain, std::forward<F>(fn));
+}
+
+} // namespace cuckoo
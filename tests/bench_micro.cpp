@@ -0,0 +1,506 @@
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <random>
+#include <span>
+#include <string>
+#include <vector>
+#include "arena_allocator.h"
+#include "cuckoo_seq.h"
+#include "cuckoo_striped.h"
+#include "cuckoo_refinable.h"
+#include "cuckoo_tx.h"
+#include "perf_counters.h"
+
+using namespace std;
+using namespace cuckoo;
+
+constexpr size_t DEFAULT_KEYS = 1 << 20;
+constexpr size_t NUM_RELOCATIONS = 20000;
+// Random keys tried in a row without finding one to relocate before
+// bench_relocate gives up
+constexpr size_t MAX_OVERFLOW_MISSES = 1 << 20;
+constexpr size_t PAGES_KEYS = 100000000;
+// The probe-set engines allocate every bucket separately, roughly 60 bytes
+// per bucket on top of the keys; above this they need more memory than a
+// typical test machine has.
+constexpr size_t PAGES_PROBE_SET_KEYS = size_t(1) << 24;
+constexpr size_t HEAVY_KEYS = 1 << 18;
+
+// Keys for the heavy-key workloads: 64 bytes copied by value, and strings
+// long enough to live on the heap.
+struct key64 {
+    uint64_t word[8];
+    bool operator==(const key64&) const = default;
+};
+
+template<>
+struct std::hash<key64> {
+    size_t operator()(const key64& k) const noexcept {
+      return k.word[0] ^ k.word[7];
+    }
+};
+
+namespace cuckoo {
+
+// Reaches the private primitives of each engine so they can be timed in
+// isolation from locking and the public add/remove paths.
+struct bench_access {
+    template<typename Table>
+    static bool present(const Table& t, int key) {
+      return t.present(key, t.hash1(key) & (t.capacity - 1), t.hash2(key) & (t.capacity - 1));
+    }
+
+    template<typename Table>
+    static void resize(Table& t) {
+      t.resize();
+    }
+
+    // Pushes key into an over-threshold probe set of table1, the state add()
+    // leaves before calling relocate(). Returns false if key's buckets do not
+    // need a relocation.
+    template<typename Table>
+    static bool overflow(Table& t, int key, size_t& bucket) {
+      size_t b1 = t.hash1(key) & (t.capacity - 1);
+      size_t b2 = t.hash2(key) & (t.capacity - 1);
+      if (t.present(key, b1, b2)) return false;
+      auto& set1 = t.table1[b1];
+      auto& set2 = t.table2[b2];
+      if (set1.size() < Table::THRESHOLD || set2.size() < Table::THRESHOLD
+          || set1.size() >= Table::PROBE_SIZE)
+        return false;
+      set1.push_back(key);
+      t.size_++;
+      bucket = b1;
+      return true;
+    }
+
+    template<typename Table>
+    static bool relocate(Table& t, size_t bucket) {
+      return t.relocate(0, bucket);
+    }
+};
+
+} // namespace cuckoo
+
+namespace {
+
+template<typename T>
+inline void do_not_optimize(const T& value) {
+    asm volatile("" : : "r,m"(value) : "memory");
+}
+
+struct measurement {
+    uint64_t ops = 0;
+    double ns = 0;
+    bench::perf_counters::reading counters;
+
+    void add(double elapsed_ns, const bench::perf_counters::reading& r) {
+      ns += elapsed_ns;
+      counters.valid = r.valid;
+      for (int i = 0; i < bench::perf_counters::NUM_EVENTS; ++i)
+        counters.value[i] += r.value[i];
+    }
+};
+
+bench::perf_counters perf;
+
+template<typename F>
+measurement measure(uint64_t ops, F&& f) {
+    measurement m;
+    m.ops = ops;
+    perf.start();
+    auto start = chrono::steady_clock::now();
+    f();
+    auto end = chrono::steady_clock::now();
+    m.add(chrono::duration<double, nano>(end - start).count(), perf.stop());
+    return m;
+}
+
+void print_header() {
+    cout << left << setw(40) << "Benchmark"
+         << setw(12) << "Ops"
+         << setw(12) << "ns/op"
+         << setw(12) << "cycles/op"
+         << setw(12) << "instr/op"
+         << setw(12) << "LLC-miss/op"
+         << setw(12) << "br-miss/op"
+         << setw(12) << "dTLB-miss/op"
+         << endl;
+    cout << string(40 + 12 * 7, '-') << endl;
+}
+
+void print_row(const string& name, const measurement& m) {
+    cout << left << setw(40) << name
+         << setw(12) << m.ops
+         << fixed << setprecision(2)
+         << setw(12) << m.ns / m.ops;
+    for (int i = 0; i < bench::perf_counters::NUM_EVENTS; ++i) {
+        if (m.counters.valid && perf.has(i))
+            cout << setw(12) << double(m.counters.value[i]) / m.ops;
+        else
+            cout << setw(12) << "-";
+    }
+    cout << endl;
+}
+
+vector<int> random_keys(size_t count, int lo, int hi, unsigned seed) {
+    mt19937 rng(seed);
+    uniform_int_distribution<int> dist(lo, hi);
+    vector<int> keys(count);
+    for (int& k : keys) k = dist(rng);
+    return keys;
+}
+
+void bench_hashes(const vector<int>& keys) {
+    print_row("mix64", measure(keys.size(), [&] {
+        uint64_t acc = 0;
+        for (int k : keys) acc ^= myhash::mix64(static_cast<uint64_t>(k));
+        do_not_optimize(acc);
+    }));
+    myhash::StdHash1<int> h1;
+    print_row("StdHash1<int>", measure(keys.size(), [&] {
+        size_t acc = 0;
+        for (int k : keys) acc ^= h1(k);
+        do_not_optimize(acc);
+    }));
+    myhash::StdHash2<int> h2;
+    print_row("StdHash2<int>", measure(keys.size(), [&] {
+        size_t acc = 0;
+        for (int k : keys) acc ^= h2(k);
+        do_not_optimize(acc);
+    }));
+}
+
+// present() on the probe-set engines, contains() on the slot engines.
+template<typename Table, bool ProbeSets>
+void bench_lookups(const string& name, const vector<int>& hits, const vector<int>& misses) {
+    Table table(hits.size());
+    for (int k : hits) table.add(k);
+
+    auto lookup = [&table](int k) {
+        if constexpr (ProbeSets)
+            return bench_access::present(table, k);
+        else
+            return table.contains(k);
+    };
+    print_row(name + " lookup hit", measure(hits.size(), [&] {
+        size_t found = 0;
+        for (int k : hits) found += lookup(k);
+        do_not_optimize(found);
+    }));
+    print_row(name + " lookup miss", measure(misses.size(), [&] {
+        size_t found = 0;
+        for (int k : misses) found += lookup(k);
+        do_not_optimize(found);
+    }));
+}
+
+// contains() one key at a time against contains_batch() on the same keys.
+template<typename Table>
+void bench_batch_lookups(const string& name, const vector<int>& hits, const vector<int>& misses) {
+    Table table(hits.size());
+    for (int k : hits) table.add(k);
+    unique_ptr<bool[]> found(new bool[max(hits.size(), misses.size())]);
+
+    for (auto [label, keys] : {pair{" hit", &hits}, pair{" miss", &misses}}) {
+        print_row(name + " contains" + label, measure(keys->size(), [&] {
+            for (size_t i = 0; i < keys->size(); ++i) found[i] = table.contains((*keys)[i]);
+            do_not_optimize(found[keys->size() - 1]);
+        }));
+        print_row(name + " contains_batch" + label, measure(keys->size(), [&] {
+            table.contains_batch(*keys, span<bool>(found.get(), keys->size()));
+            do_not_optimize(found[keys->size() - 1]);
+        }));
+    }
+}
+
+// Times single relocate() chains started from an over-threshold probe set.
+// Relocations only ever fill probe sets, so once no random key finds a full
+// pair of them the phase stops short of NUM_RELOCATIONS.
+template<typename Table>
+void bench_relocate(const string& name, size_t numKeys) {
+    Table table(numKeys / 4);
+    for (int k : random_keys(numKeys, 0, 1 << 30, 7)) table.add(k);
+
+    mt19937 rng(11);
+    uniform_int_distribution<int> dist(0, 1 << 30);
+    measurement m;
+    size_t failures = 0;
+    size_t misses = 0;
+    while (m.ops < NUM_RELOCATIONS && misses < MAX_OVERFLOW_MISSES) {
+        size_t bucket;
+        if (!bench_access::overflow(table, dist(rng), bucket)) {
+            misses++;
+            continue;
+        }
+        misses = 0;
+        perf.start();
+        auto start = chrono::steady_clock::now();
+        bool ok = bench_access::relocate(table, bucket);
+        auto end = chrono::steady_clock::now();
+        m.add(chrono::duration<double, nano>(end - start).count(), perf.stop());
+        m.ops++;
+        failures += !ok;
+    }
+    if (m.ops == 0) {
+        cout << left << setw(40) << name + " relocate" << "no over-threshold probe sets found" << endl;
+        return;
+    }
+    print_row(name + " relocate", m);
+    cout << "  (" << failures << " of " << m.ops << " chains failed";
+    if (m.ops < NUM_RELOCATIONS)
+        cout << "; stopped after " << MAX_OVERFLOW_MISSES << " keys in a row found no full probe sets";
+    cout << ")" << endl;
+}
+
+// Resize and erase_if run on the task pool, but the counters only see the
+// calling thread; wall time covers everything.
+void print_pool_note() {
+    if (perf.available())
+        cout << "  (hardware counters above cover the calling thread, not the pool workers)" << endl;
+}
+
+// ns/op is per key migrated.
+template<typename Table>
+void bench_resize(const string& name, const vector<int>& keys) {
+    Table table(keys.size());
+    for (int k : keys) table.add(k);
+    print_row(name + " resize", measure(table.size(), [&] {
+        bench_access::resize(table);
+    }));
+}
+
+// Expiring the odd keys: remove() on a list of them against one erase_if()
+// pass. ns/op is per key removed.
+template<typename Table>
+void bench_erase(const string& name, const vector<int>& keys) {
+    auto expired = [](int k) { return (k & 1) != 0; };
+    vector<int> list;
+    for (int k : keys) if (expired(k)) list.push_back(k);
+
+    Table listed(keys.size());
+    for (int k : keys) listed.add(k);
+    print_row(name + " remove (list)", measure(list.size(), [&] {
+        for (int k : list) listed.remove(k);
+    }));
+
+    Table scanned(keys.size());
+    for (int k : keys) scanned.add(k);
+    print_row(name + " erase_if", measure(list.size(), [&] {
+        do_not_optimize(scanned.erase_if(expired));
+    }));
+}
+
+// Field of /proc/self/smaps_rollup in kB, 0 if unavailable.
+size_t smaps_kb(const string& field) {
+    ifstream in("/proc/self/smaps_rollup");
+    string name;
+    size_t kb;
+    while (in >> name) {
+        if (name == field + ":" && in >> kb) return kb;
+        in.ignore(numeric_limits<streamsize>::max(), '\n');
+    }
+    return 0;
+}
+
+string read_line(const string& path) {
+    ifstream in(path);
+    string line;
+    getline(in, line);
+    return line.empty() ? "n/a" : line;
+}
+
+const char* page_mode_name(page_mode mode) {
+    switch (mode) {
+        case page_mode::standard: return "4k";
+        case page_mode::transparent_huge: return "thp";
+        case page_mode::hugetlb: return "hugetlb";
+    }
+    return "?";
+}
+
+// Lookups on a table sized for all keys up front, so no resize moves the
+// bucket arrays onto other pages mid-run. Resident memory is read while the
+// table is alive.
+template<typename Table>
+void bench_pages(const string& name, const vector<int>& hits, const vector<int>& misses) {
+    for (page_mode mode : {page_mode::standard, page_mode::transparent_huge, page_mode::hugetlb}) {
+        set_bucket_pages(mode);
+        Table table(hits.size());
+        for (int k : hits) table.add(k);
+
+        string label = name + " [" + page_mode_name(mode) + "]";
+        print_row(label + " lookup hit", measure(hits.size(), [&] {
+            size_t found = 0;
+            for (int k : hits) found += table.contains(k);
+            do_not_optimize(found);
+        }));
+        print_row(label + " lookup miss", measure(misses.size(), [&] {
+            size_t found = 0;
+            for (int k : misses) found += table.contains(k);
+            do_not_optimize(found);
+        }));
+        cout << "  rss " << smaps_kb("Rss") / 1024 << " MB, transparent huge "
+             << smaps_kb("AnonHugePages") / 1024 << " MB, hugetlb "
+             << smaps_kb("Private_Hugetlb") / 1024 << " MB" << endl;
+    }
+    set_bucket_pages(page_mode::standard);
+}
+
+key64 make_key64(int k) {
+    key64 key;
+    for (uint64_t i = 0; i < 8; ++i) key.word[i] = myhash::mix64(uint64_t(k) * 8 + i);
+    return key;
+}
+
+string make_string_key(int k) {
+    string digits = to_string(k);
+    return "session:" + string(32 - digits.size(), '0') + digits;
+}
+
+// Adds, from a table grown from its smallest size, so the keys go through
+// every relocation and resize; lookups; then one more resize. The keys are
+// handed over as rvalues, as a caller that no longer needs them would.
+template<typename Table, typename Key>
+void bench_heavy(const string& name, const vector<Key>& keys) {
+    vector<Key> batch = keys;
+    Table table;
+    print_row(name + " add", measure(batch.size(), [&] {
+        for (Key& k : batch) table.add(std::move(k));
+    }));
+    print_row(name + " lookup hit", measure(keys.size(), [&] {
+        size_t found = 0;
+        for (const Key& k : keys) found += table.contains(k);
+        do_not_optimize(found);
+    }));
+    print_row(name + " resize", measure(table.size(), [&] {
+        bench_access::resize(table);
+    }));
+}
+
+void run_heavy(size_t numKeys) {
+    auto ints = random_keys(numKeys, 0, 1 << 30, 1);
+    vector<key64> wide;
+    vector<string> strings;
+    for (int k : ints) {
+        wide.push_back(make_key64(k));
+        strings.push_back(make_string_key(k));
+    }
+
+    cout << "=== Heavy Keys ===" << endl;
+    cout << "Keys: " << numKeys << ", hardware counters: "
+         << (perf.available() ? "enabled" : "unavailable (wall time only)") << endl << endl;
+    print_header();
+
+    bench_heavy<cuckoo_seq<key64>>("cuckoo_seq key64", wide);
+    bench_heavy<cuckoo_striped<key64>>("cuckoo_striped key64", wide);
+    bench_heavy<cuckoo_refinable<key64>>("cuckoo_refinable key64", wide);
+    bench_heavy<cuckoo_tx<key64>>("cuckoo_tx key64", wide);
+    // cuckoo_tx needs trivially copyable keys
+    bench_heavy<cuckoo_seq<string>>("cuckoo_seq string", strings);
+    bench_heavy<cuckoo_striped<string>>("cuckoo_striped string", strings);
+    bench_heavy<cuckoo_refinable<string>>("cuckoo_refinable string", strings);
+    print_pool_note();
+
+    cout << string(40 + 12 * 7, '-') << endl;
+}
+
+void run_pages(size_t numKeys) {
+    auto hits = random_keys(numKeys, 0, 1 << 30, 1);
+    auto misses = random_keys(numKeys, -(1 << 30), -1, 2);
+
+    cout << "=== Bucket Page Size ===" << endl;
+    cout << "Keys: " << numKeys << ", hardware counters: "
+         << (perf.available() ? "enabled" : "unavailable (wall time only)") << endl;
+    cout << "transparent_hugepage: " << read_line("/sys/kernel/mm/transparent_hugepage/enabled")
+         << ", nr_hugepages: " << read_line("/proc/sys/vm/nr_hugepages") << endl << endl;
+    print_header();
+
+    bench_pages<cuckoo_seq<int>>("cuckoo_seq", hits, misses);
+    bench_pages<cuckoo_tx<int>>("cuckoo_tx", hits, misses);
+    if (numKeys <= PAGES_PROBE_SET_KEYS) {
+        bench_pages<cuckoo_striped<int>>("cuckoo_striped", hits, misses);
+        bench_pages<cuckoo_refinable<int>>("cuckoo_refinable", hits, misses);
+    } else {
+        cout << "(probe-set engines skipped above " << PAGES_PROBE_SET_KEYS << " keys)" << endl;
+    }
+
+    cout << string(40 + 12 * 7, '-') << endl;
+}
+
+} // namespace
+
+// Raw int slots, -1 marking empty ones: 4 bytes per slot instead of 8
+using seq_raw = cuckoo_seq<int, bucket_allocator<int>, empty_key<int, -1>>;
+using tx_raw = cuckoo_tx<int, bucket_allocator<int>, empty_key<int, -1>>;
+
+// Usage:
+//   bench_micro [num_keys]        primitives: hashes, lookups, relocate, resize,
+//                                 bulk erase
+//   bench_micro pages [num_keys]  lookups with 4k, transparent huge and hugetlb
+//                                 bucket pages (default 10^8 keys)
+//   bench_micro heavy [num_keys]  add, lookup and resize with 64-byte and
+//                                 string keys (default 2^18 keys)
+
+int main(int argc, char** argv) {
+    if (argc > 1 && string(argv[1]) == "pages") {
+        run_pages((argc > 2) ? stoul(argv[2]) : PAGES_KEYS);
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "heavy") {
+        run_heavy((argc > 2) ? stoul(argv[2]) : HEAVY_KEYS);
+        return 0;
+    }
+
+    size_t numKeys = (argc > 1) ? stoul(argv[1]) : DEFAULT_KEYS;
+
+    auto hits = random_keys(numKeys, 0, 1 << 30, 1);
+    auto misses = random_keys(numKeys, -(1 << 30), -1, 2);
+    auto order = hits;
+    shuffle(order.begin(), order.end(), mt19937(3));
+
+    cout << "=== Cuckoo Primitive Microbenchmarks ===" << endl;
+    cout << "Keys: " << numKeys << ", hardware counters: "
+         << (perf.available() ? "enabled" : "unavailable (wall time only)") << endl << endl;
+    print_header();
+
+    bench_hashes(hits);
+
+    bench_lookups<cuckoo_seq<int>, false>("cuckoo_seq", order, misses);
+    bench_lookups<cuckoo_striped<int>, true>("cuckoo_striped", order, misses);
+    bench_lookups<cuckoo_refinable<int>, true>("cuckoo_refinable", order, misses);
+    bench_lookups<cuckoo_tx<int>, false>("cuckoo_tx", order, misses);
+    bench_lookups<seq_raw, false>("cuckoo_seq (raw)", order, misses);
+    bench_lookups<tx_raw, false>("cuckoo_tx (raw)", order, misses);
+
+    bench_batch_lookups<cuckoo_seq<int>>("cuckoo_seq", order, misses);
+    bench_batch_lookups<cuckoo_striped<int>>("cuckoo_striped", order, misses);
+    bench_batch_lookups<seq_raw>("cuckoo_seq (raw)", order, misses);
+
+    bench_relocate<cuckoo_striped<int>>("cuckoo_striped", numKeys);
+    bench_relocate<cuckoo_refinable<int>>("cuckoo_refinable", numKeys);
+
+    bench_resize<cuckoo_seq<int>>("cuckoo_seq", hits);
+    bench_resize<cuckoo_striped<int>>("cuckoo_striped", hits);
+    bench_resize<cuckoo_refinable<int>>("cuckoo_refinable", hits);
+    bench_resize<cuckoo_tx<int>>("cuckoo_tx", hits);
+    bench_resize<seq_raw>("cuckoo_seq (raw)", hits);
+    bench_resize<tx_raw>("cuckoo_tx (raw)", hits);
+    bench_resize<cuckoo_striped<int, arena_allocator<int>>>("cuckoo_striped (arena)", hits);
+    bench_resize<cuckoo_refinable<int, arena_allocator<int>>>("cuckoo_refinable (arena)", hits);
+    print_pool_note();
+
+    bench_erase<cuckoo_seq<int>>("cuckoo_seq", hits);
+    bench_erase<cuckoo_striped<int>>("cuckoo_striped", hits);
+    bench_erase<cuckoo_refinable<int>>("cuckoo_refinable", hits);
+    bench_erase<cuckoo_tx<int>>("cuckoo_tx", hits);
+    print_pool_note();
+
+    cout << string(40 + 12 * 7, '-') << endl;
+    return 0;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <algorithm>
+#include <cctype>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <pthread.h>
+#include <sched.h>
+#include <set>
+#include <string>
+#include <tuple>
+#include <vector>
+
+namespace bench {
+
+// Where one hardware thread sits, from /sys/devices/system/cpu/cpuN. core
+// and sibling are ranks: the core's position among its package's cores, and
+// the thread's among its core's threads. Missing files (non-Linux sysfs,
+// some containers) leave each CPU in package and node 0 as a core of its own.
+struct cpu_info {
+    int cpu = 0;
+    int package = 0;
+    int node = 0;
+    int core = 0;
+    int sibling = 0;
+};
+
+enum class placement { compact, scatter };
+
+inline const char* placement_name(placement p) {
+    return p == placement::compact ? "compact" : "scatter";
+}
+
+inline int read_sysfs_int(const std::string& path, int fallback) {
+    std::ifstream in(path);
+    int value;
+    return (in >> value) ? value : fallback;
+}
+
+// The CPUs this process may run on, in CPU number order.
+inline std::vector<cpu_info> cpu_topology() {
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) return {cpu_info{}};
+
+    std::vector<cpu_info> cpus;
+    std::vector<int> core_ids;
+    for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &allowed)) continue;
+        std::string dir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+        cpu_info info;
+        info.cpu = cpu;
+        info.package = read_sysfs_int(dir + "/topology/physical_package_id", 0);
+        std::error_code ec;
+        for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+            std::string name = entry.path().filename();
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0
+                && std::all_of(name.begin() + 4, name.end(), ::isdigit))
+                info.node = std::stoi(name.substr(4));
+        }
+        cpus.push_back(info);
+        core_ids.push_back(read_sysfs_int(dir + "/topology/core_id", cpu));
+    }
+
+    // rank the core ids within each package, and the threads within each core
+    std::map<int, std::set<int>> package_cores;
+    for (size_t i = 0; i < cpus.size(); ++i) package_cores[cpus[i].package].insert(core_ids[i]);
+    std::map<std::pair<int, int>, int> threads_seen;
+    for (size_t i = 0; i < cpus.size(); ++i) {
+        const std::set<int>& cores = package_cores[cpus[i].package];
+        cpus[i].core = static_cast<int>(std::distance(cores.begin(), cores.find(core_ids[i])));
+        cpus[i].sibling = threads_seen[{cpus[i].package, core_ids[i]}]++;
+    }
+    return cpus;
+}
+
+// The order workers are pinned in. Compact fills every hardware thread of
+// a core, then the next core of the package, then the next package: workers
+// share caches first. Scatter takes one thread per core, alternating
+// packages, and only then the SMT siblings: workers get a core each first.
+inline std::vector<int> placement_order(std::vector<cpu_info> cpus, placement p) {
+    std::sort(cpus.begin(), cpus.end(), [p](const cpu_info& a, const cpu_info& b) {
+        if (p == placement::compact)
+            return std::tie(a.package, a.core, a.sibling) < std::tie(b.package, b.core, b.sibling);
+        return std::tie(a.sibling, a.core, a.package) < std::tie(b.sibling, b.core, b.package);
+    });
+    std::vector<int> order;
+    for (const cpu_info& c : cpus) order.push_back(c.cpu);
+    return order;
+}
+
+// Pins the calling thread to one CPU. False if the kernel refused.
+inline bool pin_thread(int cpu) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+}
+
+} // namespace bench
@@ -0,0 +1,93 @@
+#pragma once
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+namespace bench {
+
+// HDR-style log-linear histogram of latencies in nanoseconds.
+// Each power of two is split into 2^SUB_BITS linear sub-buckets, so every
+// recorded value is kept with ~3% relative precision. One histogram is owned
+// by a single thread; histograms are merged after the threads are joined.
+class latency_histogram {
+public:
+    static constexpr unsigned SUB_BITS = 5;
+    static constexpr uint64_t SUB = uint64_t(1) << SUB_BITS;
+    static constexpr size_t NUM_BUCKETS = (64 - SUB_BITS + 1) * SUB;
+
+    void record(uint64_t ns) {
+      counts[index_of(ns)]++;
+      total++;
+      max_ = std::max(max_, ns);
+    }
+
+    void merge(const latency_histogram& other) {
+      for (size_t i = 0; i < NUM_BUCKETS; ++i)
+        counts[i] += other.counts[i];
+      total += other.total;
+      max_ = std::max(max_, other.max_);
+    }
+
+    // Highest value equivalent to the bucket holding the p-th percentile.
+    uint64_t percentile(double p) const {
+      if (total == 0) return 0;
+      uint64_t rank = static_cast<uint64_t>(p / 100.0 * total + 0.5);
+      if (rank == 0) rank = 1;
+      uint64_t seen = 0;
+      for (size_t i = 0; i < NUM_BUCKETS; ++i) {
+        seen += counts[i];
+        if (seen >= rank) return std::min(highest_in(i), max_);
+      }
+      return max_;
+    }
+
+    uint64_t count() const { return total; }
+    uint64_t max() const { return max_; }
+
+private:
+    static size_t index_of(uint64_t v) {
+      if (v < SUB) return v;
+      unsigned shift = (63 - __builtin_clzll(v)) - SUB_BITS;
+      return ((shift + 1) << SUB_BITS) + ((v >> shift) - SUB);
+    }
+
+    static uint64_t highest_in(size_t idx) {
+      if (idx < SUB) return idx;
+      unsigned shift = idx / SUB - 1;
+      uint64_t mantissa = idx % SUB + SUB;
+      return ((mantissa + 1) << shift) - 1;
+    }
+
+    std::array<uint64_t, NUM_BUCKETS> counts{};
+    uint64_t total = 0;
+    uint64_t max_ = 0;
+};
+
+enum op_type { OP_CONTAINS = 0, OP_ADD = 1, OP_REMOVE = 2, NUM_OP_TYPES = 3 };
+
+inline const char* op_name(int op) {
+    static const char* names[] = {"contains", "add", "remove"};
+    return names[op];
+}
+
+// Per-thread set of histograms, one per operation type.
+struct latency_recorder {
+    std::array<latency_histogram, NUM_OP_TYPES> hist;
+
+    template<typename F>
+    auto time(op_type op, F&& f) {
+      auto start = std::chrono::steady_clock::now();
+      auto res = f();
+      auto end = std::chrono::steady_clock::now();
+      hist[op].record(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+      return res;
+    }
+
+    void merge(const latency_recorder& other) {
+      for (int op = 0; op < NUM_OP_TYPES; ++op)
+        hist[op].merge(other.hist[op]);
+    }
+};
+
+} // namespace bench
@@ -0,0 +1,190 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "latency_histogram.h"
+
+namespace bench {
+
+// Binary operation traces: a trace_header, then fixed-size records. The
+// first `preload` records are adds that build the starting table and are
+// not timed; the `ops` records after them are the workload. Records are
+// native-endian, written and read on the same kind of machine.
+//
+// A generated trace is a function of its seed and parameters alone, so
+// every run and every engine replays the same operations. A text log with
+// one "add|contains|remove <key>" per line converts to a trace with no
+// preload.
+struct trace_record {
+    int32_t key;
+    uint8_t op; // op_type
+    uint8_t reserved[3] = {};
+};
+static_assert(sizeof(trace_record) == 8);
+
+struct trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t preload;
+    uint64_t ops;
+};
+
+inline constexpr char TRACE_MAGIC[8] = {'C', 'K', 'T', 'R', 'A', 'C', 'E', '1'};
+inline constexpr uint32_t TRACE_VERSION = 1;
+
+// Streams records to a trace file; the header is filled in by close().
+// Preload records must all come before the first op.
+class trace_writer {
+public:
+    explicit trace_writer(const std::string& path) : out(path, std::ios::binary | std::ios::trunc) {
+      if (!out) throw std::runtime_error("cannot write " + path);
+      std::memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+      header.version = TRACE_VERSION;
+      header.record_size = sizeof(trace_record);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+
+    ~trace_writer() {
+      if (out.is_open()) close();
+    }
+
+    trace_writer(const trace_writer&) = delete;
+    trace_writer& operator=(const trace_writer&) = delete;
+
+    void preload(int32_t key) {
+      if (header.ops != 0) throw std::logic_error("trace preload after the first op");
+      put(OP_ADD, key);
+      header.preload++;
+    }
+
+    void op(op_type type, int32_t key) {
+      put(type, key);
+      header.ops++;
+    }
+
+    void close() {
+      out.seekp(0);
+      out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+      out.close();
+    }
+
+private:
+    void put(op_type type, int32_t key) {
+      trace_record r{key, static_cast<uint8_t>(type)};
+      out.write(reinterpret_cast<const char*>(&r), sizeof(r));
+    }
+
+    std::ofstream out;
+    trace_header header{};
+};
+
+// preload keys in [0, max_key], then ops operations with the given read
+// and insert ratios (the rest are removes), all drawn from mt19937(seed).
+inline void generate_trace(const std::string& path, unsigned seed, uint64_t preload, uint64_t ops,
+                           double read_ratio, double insert_ratio, int32_t max_key) {
+    std::mt19937 rng(seed);
+    std::uniform_int_distribution<int32_t> keyDist(0, max_key);
+    std::uniform_real_distribution<double> opDist(0.0, 1.0);
+    trace_writer w(path);
+    for (uint64_t i = 0; i < preload; ++i) w.preload(keyDist(rng));
+    for (uint64_t i = 0; i < ops; ++i) {
+      double op = opDist(rng);
+      int32_t key = keyDist(rng);
+      w.op(op < read_ratio ? OP_CONTAINS : op < read_ratio + insert_ratio ? OP_ADD : OP_REMOVE, key);
+    }
+}
+
+// Converts a text log, one "<op> <key>" per line with op one of op_name()'s
+// names; blank lines and # comments are skipped. Returns the ops written.
+inline uint64_t convert_log(std::istream& in, const std::string& path) {
+    trace_writer w(path);
+    uint64_t ops = 0, line_no = 0;
+    for (std::string line; std::getline(in, line);) {
+      line_no++;
+      line = line.substr(0, line.find('#'));
+      std::istringstream fields(line);
+      std::string name;
+      int32_t key;
+      if (!(fields >> name)) continue;
+      int type = 0;
+      while (type < NUM_OP_TYPES && name != op_name(type)) type++;
+      if (type == NUM_OP_TYPES || !(fields >> key))
+        throw std::invalid_argument("line " + std::to_string(line_no) + ": expected <op> <key>");
+      w.op(static_cast<op_type>(type), key);
+      ops++;
+    }
+    return ops;
+}
+
+// A trace file mapped read-only. The pages are populated up front, so a
+// replay does not fault them in while it is timed.
+class mapped_trace {
+public:
+    explicit mapped_trace(const std::string& path) {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd < 0) throw std::runtime_error("cannot read " + path);
+      struct stat st;
+      if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(trace_header)) {
+        ::close(fd);
+        throw std::runtime_error(path + ": not a trace");
+      }
+      length = st.st_size;
+      base = mmap(nullptr, length, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+      ::close(fd);
+      if (base == MAP_FAILED) throw std::runtime_error("cannot map " + path);
+
+      const trace_header& h = header();
+      if (std::memcmp(h.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0 || h.version != TRACE_VERSION
+          || h.record_size != sizeof(trace_record)
+          || length != sizeof(trace_header) + (h.preload + h.ops) * sizeof(trace_record)) {
+        munmap(base, length);
+        throw std::runtime_error(path + ": not a trace, or truncated");
+      }
+    }
+
+    ~mapped_trace() {
+      munmap(base, length);
+    }
+
+    mapped_trace(const mapped_trace&) = delete;
+    mapped_trace& operator=(const mapped_trace&) = delete;
+
+    std::span<const trace_record> preload() const {
+      return {records(), header().preload};
+    }
+
+    std::span<const trace_record> ops() const {
+      return {records() + header().preload, header().ops};
+    }
+
+    // Thread i's share of ops(): contiguous, and within one record of the
+    // others' sizes.
+    std::span<const trace_record> slice(size_t i, size_t threads) const {
+      size_t n = header().ops;
+      return ops().subspan(i * n / threads, (i + 1) * n / threads - i * n / threads);
+    }
+
+private:
+    const trace_header& header() const {
+      return *static_cast<const trace_header*>(base);
+    }
+
+    const trace_record* records() const {
+      return reinterpret_cast<const trace_record*>(static_cast<const char*>(base) + sizeof(trace_header));
+    }
+
+    void* base = nullptr;
+    size_t length = 0;
+};
+
+} // namespace bench
@@ -0,0 +1,108 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace bench {
+
+// Hardware counters for the calling thread, read as one perf_event group.
+// When perf_event_open is not permitted (containers, perf_event_paranoid,
+// no PMU) available() is false and callers fall back to wall time only.
+// The dTLB event is optional: not every PMU exposes it, and has() reports
+// whether it was opened.
+class perf_counters {
+public:
+    enum { CYCLES, INSTRUCTIONS, CACHE_MISSES, BRANCH_MISSES, DTLB_MISSES, NUM_EVENTS };
+
+    struct reading {
+      bool valid = false;
+      uint64_t value[NUM_EVENTS] = {};
+    };
+
+    perf_counters() {
+      static const uint32_t types[NUM_EVENTS] = {
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HARDWARE,
+        PERF_TYPE_HW_CACHE,
+      };
+      static const uint64_t configs[NUM_EVENTS] = {
+        PERF_COUNT_HW_CPU_CYCLES,
+        PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES,
+        PERF_COUNT_HW_BRANCH_MISSES,
+        PERF_COUNT_HW_CACHE_DTLB
+          | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+          | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+      };
+      for (int i = 0; i < NUM_EVENTS; ++i) {
+        fds[i] = open_event(types[i], configs[i], i == 0 ? -1 : fds[0]);
+        if (fds[i] >= 0) {
+          num_open++;
+        } else if (i != DTLB_MISSES) {
+          close_all();
+          return;
+        }
+      }
+    }
+
+    ~perf_counters() { close_all(); }
+
+    perf_counters(const perf_counters&) = delete;
+    perf_counters& operator=(const perf_counters&) = delete;
+
+    bool available() const { return fds[0] >= 0; }
+    bool has(int event) const { return fds[event] >= 0; }
+
+    void start() {
+      if (!available()) return;
+      ioctl(fds[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+      ioctl(fds[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+
+    reading stop() {
+      reading r;
+      if (!available()) return r;
+      ioctl(fds[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+      // PERF_FORMAT_GROUP layout: nr, then one value per opened event
+      uint64_t buf[1 + NUM_EVENTS];
+      ssize_t bytes = (1 + num_open) * sizeof(uint64_t);
+      if (read(fds[0], buf, bytes) != bytes || buf[0] != uint64_t(num_open))
+        return r;
+      for (int i = 0, j = 1; i < NUM_EVENTS; ++i)
+        if (fds[i] >= 0) r.value[i] = buf[j++];
+      r.valid = true;
+      return r;
+    }
+
+private:
+    static int open_event(uint32_t type, uint64_t config, int group_fd) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.type = type;
+      attr.size = sizeof(attr);
+      attr.config = config;
+      attr.disabled = (group_fd == -1);
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_GROUP;
+      return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0));
+    }
+
+    void close_all() {
+      for (int& fd : fds) {
+        if (fd >= 0) close(fd);
+        fd = -1;
+      }
+      num_open = 0;
+    }
+
+    int fds[NUM_EVENTS] = {-1, -1, -1, -1, -1};
+    int num_open = 0;
+};
+
+} // namespace bench
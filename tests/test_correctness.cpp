@@ -1,15 +1,34 @@
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <unordered_set>
 #include <vector>
 #include <random>
 #include <cassert>
+#include "arena_allocator.h"
+#include "cuckoo_adaptive.h"
+#include "cuckoo_counter.h"
+#include "cuckoo_filter.h"
+#include "cuckoo_hopscotch.h"
 #include "cuckoo_seq.h"
+#include "cuckoo_sharded.h"
 #include "cuckoo_striped.h"
+#include "cuckoo_rcu.h"
 #include "cuckoo_refinable.h"
 #include "cuckoo_tx.h"
+#include "locked_set.h"
+#include "task_pool.h"
 
 using namespace cuckoo;
 
+// Threads, and keys per thread, of the concurrent checks
+constexpr int THREADS = 4;
+constexpr int KEYS = 20000;
+
 template<typename Key, typename Table>
 void test_generic(Key& key, int op, cuckoo_seq<Key>& cuckooSet, 
                   cuckoo_striped<Key>& concSet, cuckoo_refinable<Key>& concSet2,
@@ -68,6 +87,42 @@ void final_check(cuckoo_seq<Key>& cuckooSet,
     assert(concSet2.contains(*it));
     assert(concSet3.contains(*it));
   }
+
+  // Batched lookups over every key, half of the first 100 removed again
+  std::vector<Key> keys(refSet.begin(), refSet.end());
+  for(size_t i = 0; i < keys.size() && i < 100; i += 2){
+    refSet.erase(keys[i]);
+    cuckooSet.remove(keys[i]);
+    concSet.remove(keys[i]);
+  }
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  cuckooSet.contains_batch(keys, std::span<bool>(found.get(), keys.size()));
+  for(size_t i = 0; i < keys.size(); i++) assert(found[i] == (refSet.count(keys[i]) > 0));
+  concSet.contains_batch(keys, std::span<bool>(found.get(), keys.size()));
+  for(size_t i = 0; i < keys.size(); i++) assert(found[i] == (refSet.count(keys[i]) > 0));
+
+  // Bulk erase of about a third of what is left
+  for(size_t i = 0; i < keys.size() && i < 100; i += 2){
+    concSet2.remove(keys[i]);
+    concSet3.remove(keys[i]);
+  }
+  auto expired = [](const Key& k){ return std::hash<Key>()(k) % 3 == 0; };
+  size_t erased = std::erase_if(refSet, expired);
+  assert(cuckooSet.erase_if(expired) == erased);
+  assert(concSet.erase_if(expired) == erased);
+  assert(concSet2.erase_if(expired) == erased);
+  assert(concSet3.retain([&](const Key& k){ return !expired(k); }) == erased);
+  assert(cuckooSet.size() == refSet.size());
+  assert(concSet.size() == refSet.size());
+  assert(concSet2.size() == refSet.size());
+  assert(concSet3.size() == refSet.size());
+  for(const Key& k : keys){
+    bool expected = refSet.count(k) > 0;
+    assert(cuckooSet.contains(k) == expected);
+    assert(concSet.contains(k) == expected);
+    assert(concSet2.contains(k) == expected);
+    assert(concSet3.contains(k) == expected);
+  }
 }
 
 void test_ints(){
@@ -96,7 +151,7 @@ void test_strings(){
   cuckoo_seq<std::string> cuckooSet;
   cuckoo_striped<std::string> concSet;
   cuckoo_refinable<std::string> concSet2;
-  cuckoo_striped<std::string> concSet3;
+  cuckoo_striped<std::string, arena_allocator<std::string>> concSet3;
   std::unordered_set<std::string> refSet;
 
   for (int i = 0; i < 5000; ++i) {
@@ -141,7 +196,7 @@ void test_user_defined_class(){
   cuckoo_seq<Point> cuckooSet;
   cuckoo_striped<Point> concSet;
   cuckoo_refinable<Point> concSet2;
-  cuckoo_striped<Point> concSet3;
+  cuckoo_refinable<Point, arena_allocator<Point>> concSet3;
   std::unordered_set<Point> refSet;
 
   for (int i = 0; i < 5000; ++i) {
@@ -154,10 +209,592 @@ void test_user_defined_class(){
   final_check(cuckooSet, concSet, concSet2, concSet3, refSet);
 }
 
+// A key aligned past what plain operator new guarantees.
+struct alignas(64) WideKey {
+  int v;
+  bool operator==(const WideKey& other) const {
+    return v == other.v;
+  }
+};
+
+namespace std {
+template<>
+struct hash<WideKey> {
+  size_t operator()(const WideKey& k) const {
+    return std::hash<int>()(k.v);
+  }
+};
+}
+
+void test_aligned_keys(){
+  bucket_allocator<WideKey> alloc;
+  for (size_t n : {1, 3, 17}) {
+    WideKey* p = alloc.allocate(n);
+    assert(reinterpret_cast<uintptr_t>(p) % alignof(WideKey) == 0);
+    alloc.deallocate(p, n);
+  }
+  cuckoo_seq<WideKey> seq(4);
+  cuckoo_striped<WideKey> striped(4);
+  for (int i = 0; i < 2000; ++i) {
+    assert(seq.add(WideKey{i}));
+    assert(striped.add(WideKey{i}));
+  }
+  for (int i = 0; i < 2000; ++i) assert(seq.contains(WideKey{i}) && striped.contains(WideKey{i}));
+}
+
+// A key that can only be moved. Hashing or comparing one that was moved from
+// dereferences a null pointer, so a key left behind by a move shows up.
+struct Ticket {
+  std::unique_ptr<int> id;
+
+  explicit Ticket(int i) : id(new int(i)) {}
+  Ticket(Ticket&&) = default;
+  Ticket& operator=(Ticket&&) = default;
+
+  bool operator==(const Ticket& other) const {
+    return *id == *other.id;
+  }
+};
+
+namespace std {
+template<>
+struct hash<Ticket> {
+  size_t operator()(const Ticket& t) const {
+    return std::hash<int>()(*t.id);
+  }
+};
+}
+
+// Move-only keys through add, relocation and resize of every engine that
+// does not copy keys (cuckoo_tx and cuckoo_rcu do), starting small so all
+// of them grow several times.
+template<typename Table>
+void check_move_only(Table& table){
+  std::mt19937 rng;
+  std::uniform_int_distribution<int> dist(0, 3000);
+  std::unordered_set<int> refSet;
+  for (int i = 0; i < 10000; ++i) {
+    int key = dist(rng);
+    int op = rng() % 3;
+    if (op == 0) assert(table.add(Ticket(key)) == refSet.insert(key).second);
+    else if (op == 1) assert(table.remove(Ticket(key)) == (refSet.erase(key) > 0));
+    else assert(table.contains(Ticket(key)) == (refSet.count(key) > 0));
+  }
+  assert(table.size() == refSet.size());
+  for (int key : refSet) assert(table.contains(Ticket(key)));
+}
+
+void test_move_only_keys(){
+  cuckoo_seq<Ticket> seq(4);
+  check_move_only(seq);
+  cuckoo_striped<Ticket> striped(4);
+  check_move_only(striped);
+  cuckoo_refinable<Ticket> refinable(4);
+  check_move_only(refinable);
+  cuckoo_sharded<Ticket> sharded(4);
+  check_move_only(sharded);
+  locked_set<Ticket> locked(4);
+  check_move_only(locked);
+  cuckoo_hopscotch<Ticket> hopscotch(4);
+  check_move_only(hopscotch);
+  cuckoo_adaptive<Ticket> adaptive(4);
+  adaptive.switch_to(adaptive_mode::striped);
+  check_move_only(adaptive);
+  adaptive.switch_to(adaptive_mode::sequential);
+  for (int key = 0; key <= 3000; ++key)
+    assert(adaptive.contains(Ticket(key)) == seq.contains(Ticket(key)));
+}
+
+// memory_usage() against what each engine must at least hold: two arrays of
+// bucket_count() buckets, and for the probe-set engines an array per
+// non-empty probe set.
+void test_memory_usage(){
+  std::vector<int> keys;
+  for (int i = 0; i < 20000; ++i) keys.push_back(i * 7);
+
+  cuckoo_seq<int> seq;
+  cuckoo_striped<int> striped;
+  cuckoo_refinable<int> refinable;
+  cuckoo_tx<int> tx;
+  cuckoo_rcu<int> rcu;
+  cuckoo_adaptive<int> adaptive;
+  seq.populate(keys);
+  striped.populate(keys);
+  refinable.populate(keys);
+  tx.populate(keys);
+  rcu.populate(keys);
+  adaptive.populate(keys);
+
+  cuckoo_memory m = seq.memory_usage();
+  assert(m.table_bytes >= 2 * seq.bucket_count() * sizeof(std::optional<int>));
+  assert(m.lock_bytes == 0 && m.overflow_bytes == 0);
+  m = tx.memory_usage();
+  assert(m.table_bytes == 2 * tx.bucket_count() * sizeof(std::optional<int>));
+  assert(m.overflow_bytes == m.table_bytes / 2); // the arrays before the last resize
+  for (cuckoo_memory pm : {striped.memory_usage(), refinable.memory_usage()}) {
+    assert(pm.overflow_bytes >= keys.size() * sizeof(int));
+    assert(pm.lock_bytes > 0);
+  }
+  assert(refinable.memory_usage().lock_bytes >= 2 * refinable.bucket_count() * sizeof(std::recursive_mutex));
+  assert(rcu.memory_usage().table_bytes >= 2 * rcu.bucket_count() * sizeof(std::optional<int>));
+  assert(adaptive.memory_usage().table_bytes >= 2 * adaptive.bucket_count() * sizeof(std::optional<int>));
+  assert(m.total() == m.table_bytes + m.lock_bytes + m.overflow_bytes);
+
+  filtered_set<cuckoo_seq<int>> filtered(keys.size());
+  filtered.populate(keys);
+  size_t filter_bytes = filtered.filter().bucket_count() * cuckoo_filter<int>::SLOTS * sizeof(uint16_t);
+  assert(filtered.memory_usage().table_bytes == filtered.table().memory_usage().table_bytes + filter_bytes);
+  cuckoo_counter<int> counter;
+  for (int key : keys) counter.increment(key);
+  assert(counter.memory_usage().table_bytes >= 2 * counter.bucket_count() * sizeof(uint64_t));
+}
+
+// cuckoo_seq and cuckoo_tx with raw int slots and -1 marking empty ones,
+// against std::unordered_set. The reserved key is never stored.
+void test_empty_key(){
+  using slots = empty_key<int, -1>;
+  std::mt19937 rng;
+  std::uniform_int_distribution<int> dist(0, 5000);
+  cuckoo_seq<int, bucket_allocator<int>, slots> seq;
+  cuckoo_tx<int, bucket_allocator<int>, slots> tx;
+  std::unordered_set<int> refSet;
+
+  for (int i = 0; i < 20000; ++i) {
+    int key = dist(rng);
+    int op = rng() % 3;
+    if (op == 0) {
+      bool expected = refSet.insert(key).second;
+      assert(seq.add(key) == expected);
+      assert(tx.add(key) == expected);
+    } else if (op == 1) {
+      bool expected = refSet.erase(key) > 0;
+      assert(seq.remove(key) == expected);
+      assert(tx.remove(key) == expected);
+    } else {
+      bool expected = refSet.count(key) > 0;
+      assert(seq.contains(key) == expected);
+      assert(tx.contains(key) == expected);
+    }
+  }
+  assert(!seq.contains(-1) && !tx.contains(-1));
+  assert(!seq.remove(-1) && !tx.remove(-1));
+  bool threw = false;
+  try { seq.add(-1); } catch (const std::invalid_argument&) { threw = true; }
+  assert(threw);
+  threw = false;
+  try { tx.add(-1); } catch (const std::invalid_argument&) { threw = true; }
+  assert(threw);
+
+  std::vector<tx_op<int>> ops = {{tx_op_kind::contains, -1}, {tx_op_kind::remove, -1}};
+  bool results[2] = {true, true};
+  tx.run_batch(ops, results);
+  assert(!results[0] && !results[1]);
+
+  auto expired = [](int key){ return key % 3 == 0; };
+  size_t erased = std::erase_if(refSet, expired);
+  assert(seq.erase_if(expired) == erased);
+  assert(tx.erase_if(expired) == erased);
+  assert(seq.size() == refSet.size() && tx.size() == refSet.size());
+  std::vector<int> keys(refSet.begin(), refSet.end());
+  keys.push_back(-1);
+  std::unique_ptr<bool[]> found(new bool[keys.size()]);
+  seq.contains_batch(keys, std::span<bool>(found.get(), keys.size()));
+  for (size_t i = 0; i < keys.size(); i++) assert(found[i] == (keys[i] != -1));
+  for (int key : refSet) assert(tx.contains(key));
+}
+
+// run_batch() on mixed ops against the same ops applied one by one to a
+// std::unordered_set. The table starts small so batched adds hit long
+// chains and resizes.
+void test_tx_batch(){
+  std::mt19937 rng;
+  std::uniform_int_distribution<int> dist(0, 5000);
+  cuckoo_tx<int> table;
+  std::unordered_set<int> refSet;
+
+  for (int round = 0; round < 200; ++round) {
+    std::vector<tx_op<int>> ops;
+    for (int i = 0; i < 100; ++i)
+      ops.push_back({static_cast<tx_op_kind>(rng() % 3), dist(rng)});
+    std::unique_ptr<bool[]> results(new bool[ops.size()]);
+    table.run_batch(ops, std::span<bool>(results.get(), ops.size()));
+    for (size_t i = 0; i < ops.size(); ++i) {
+      bool expected;
+      if (ops[i].kind == tx_op_kind::add) expected = refSet.insert(ops[i].key).second;
+      else if (ops[i].kind == tx_op_kind::remove) expected = refSet.erase(ops[i].key) > 0;
+      else expected = refSet.count(ops[i].key) > 0;
+      assert(results[i] == expected);
+    }
+  }
+  assert(table.size() == refSet.size());
+  for (int key : refSet) assert(table.contains(key));
+}
+
+// Random increments and decrements against a std::unordered_map. Keys are
+// drawn from a small range so counts build up and drop back to zero.
+template<typename Key, typename MakeKey>
+void test_counter_ops(MakeKey make_key){
+  std::mt19937 rng;
+  cuckoo_counter<Key> counter;
+  std::unordered_map<Key, uint64_t> refMap;
+
+  for (int i = 0; i < 20000; ++i) {
+    Key key = make_key(rng);
+    int op = rng() % 3;
+    if (op == 0) {
+      uint64_t delta = 1 + rng() % 3;
+      assert(counter.increment(key, delta) == (refMap[key] += delta));
+    } else if (op == 1) {
+      auto it = refMap.find(key);
+      uint64_t expected = 0;
+      if (it != refMap.end() && --it->second > 0) expected = it->second;
+      else if (it != refMap.end()) refMap.erase(it);
+      assert(counter.decrement_and_erase_if_zero(key) == expected);
+    } else {
+      auto it = refMap.find(key);
+      assert(counter.get(key) == (it == refMap.end() ? 0 : it->second));
+    }
+  }
+  assert(counter.size() == refMap.size());
+  for (auto& [key, count] : refMap) assert(counter.get(key) == count);
+}
+
+void test_counter(){
+  test_counter_ops<int>([](std::mt19937& rng){ return int(rng() % 2000); });
+  test_counter_ops<std::string>([](std::mt19937& rng){ return std::to_string(rng() % 2000); });
+
+  // A delta past the 32-bit packed count must throw, not carry into the key
+  cuckoo_counter<int> packed;
+  packed.increment(5);
+  bool threw = false;
+  try { packed.increment(5, uint64_t(1) << 32); } catch (const std::overflow_error&) { threw = true; }
+  assert(threw);
+  threw = false;
+  try { packed.increment(6, uint64_t(1) << 32); } catch (const std::overflow_error&) { threw = true; }
+  assert(threw);
+  assert(packed.get(5) == 1 && packed.get(6) == 0 && packed.size() == 1);
+
+  // Hot keys counted from several threads while new keys force resizes
+  constexpr int ROUNDS = 20000;
+  cuckoo_counter<int> counter;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([&counter, t]{
+      for (int i = 0; i < ROUNDS; ++i) {
+        counter.increment(i % 8, 2);
+        counter.increment(1000 + t * ROUNDS + i);
+        counter.decrement_and_erase_if_zero(i % 8);
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+  for (int k = 0; k < 8; ++k) assert(counter.get(k) == THREADS * ROUNDS / 8);
+  assert(counter.size() == 8 + THREADS * ROUNDS);
+}
+
+// Random adds, removes and lookups of make_key(0 .. range - 1) on table, each
+// checked against refSet.
+template<typename Table, typename Key, typename MakeKey = std::identity>
+void check_ops(Table& table, std::unordered_set<Key>& refSet, std::mt19937& rng,
+               int ops, int range, MakeKey make_key = {}){
+  for (int i = 0; i < ops; ++i) {
+    Key key = make_key(int(rng() % range));
+    int op = rng() % 3;
+    if (op == 0) assert(table.add(key) == refSet.insert(key).second);
+    else if (op == 1) assert(table.remove(key) == (refSet.erase(key) > 0));
+    else assert(table.contains(key) == (refSet.count(key) > 0));
+  }
+  assert(table.size() == refSet.size());
+}
+
+// THREADS threads each add keys keys of their own, removing every other one
+// again; on_start(t) runs in thread t before its first add. Keys already in
+// shared must not collide with 0 .. THREADS * keys - 1.
+template<typename Table, typename OnStart>
+void check_concurrent(Table& shared, int keys, OnStart on_start){
+  size_t before = shared.size();
+  std::vector<std::thread> threads;
+  for (int t = 0; t < THREADS; ++t) {
+    threads.emplace_back([&shared, &on_start, keys, t]{
+      on_start(t);
+      for (int i = 0; i < keys; ++i) {
+        assert(shared.add(t * keys + i));
+        if (i % 2) assert(shared.remove(t * keys + i - 1));
+        assert(shared.contains(t * keys + i));
+      }
+    });
+  }
+  for (auto& th : threads) th.join();
+  assert(shared.size() == before + THREADS * keys / 2);
+  for (int key = 1; key < THREADS * keys; key += 2) assert(shared.contains(key));
+}
+
+template<typename Table>
+void check_concurrent(Table& shared, int keys = KEYS){
+  check_concurrent(shared, keys, [](int){});
+}
+
+// cuckoo_filter must never report an added key absent. Keys come and go
+// against a count of how often each was added; absent keys give the false
+// positive rate. Then a small filter is filled until add() refuses.
+void test_filter(){
+  std::mt19937 rng;
+  cuckoo_filter<int> filter(4000);
+  std::unordered_map<int, int> added;
+  for (int i = 0; i < 20000; ++i) {
+    int key = rng() % 5000;
+    if (rng() % 2 == 0) {
+      if (filter.add(key)) added[key]++;
+    } else if (added[key] > 0) {
+      assert(filter.remove(key));
+      added[key]--;
+    }
+  }
+  size_t total = 0;
+  for (auto& [key, count] : added) {
+    if (count > 0) assert(filter.contains(key));
+    total += count;
+  }
+  assert(filter.size() == total);
+  int false_positives = 0;
+  for (int key = 10000; key < 110000; ++key) false_positives += filter.contains(key);
+  assert(false_positives < 1000);
+
+  cuckoo_filter<int> small(64);
+  std::vector<int> in;
+  for (int key = 0; small.add(key); ++key) in.push_back(key);
+  assert(in.size() >= 64);
+  for (int key : in) assert(small.contains(key));
+  for (int key : in) assert(small.remove(key));
+  assert(small.size() == 0);
+
+  // In front of engines, one of them with a filter too small to keep up
+  filtered_set<cuckoo_seq<int>> seqSet(5000);
+  filtered_set<cuckoo_striped<int>> stripedSet(5000);
+  filtered_set<cuckoo_tx<int>> txSet(64);
+  auto check = [&rng](auto& set){
+    std::unordered_set<int> refSet;
+    check_ops(set, refSet, rng, 20000, 5000);
+  };
+  check(seqSet);
+  check(stripedSet);
+  check(txSet);
+  assert(seqSet.filtering() && stripedSet.filtering() && !txSet.filtering());
+
+  // Concurrent adds and removes of disjoint keys, many of them displacing
+  cuckoo_filter<int> shared(THREADS * KEYS);
+  check_concurrent(shared);
+}
+
+// cuckoo_rcu against std::unordered_set: single ops, batches through
+// update(), then lookups racing writers that publish new versions.
+void test_rcu(){
+  std::mt19937 rng;
+  cuckoo_rcu<int> table;
+  std::unordered_set<int> refSet;
+  check_ops(table, refSet, rng, 2000, 1000);
+  for (int round = 0; round < 20; ++round) {
+    std::vector<int> keys;
+    for (int i = 0; i < 500; ++i) keys.push_back(rng() % 5000);
+    table.update([&](cuckoo_seq<int>& next){
+      for (int key : keys) {
+        if (key % 2) next.add(key); else next.remove(key);
+      }
+    });
+    for (int key : keys) {
+      if (key % 2) refSet.insert(key); else refSet.erase(key);
+    }
+  }
+  auto expired = [](int key){ return key % 3 == 0; };
+  assert(table.erase_if(expired) == std::erase_if(refSet, expired));
+  assert(table.size() == refSet.size());
+  for (int key = 0; key < 5000; ++key) assert(table.contains(key) == (refSet.count(key) > 0));
+
+  // Negative keys stay put while writers publish versions around them
+  cuckoo_rcu<int> shared;
+  std::vector<int> stable;
+  for (int key = -1000; key < 0; ++key) stable.push_back(key);
+  shared.populate(stable);
+  std::atomic<bool> stop{false};
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 2; ++t) {
+    readers.emplace_back([&]{
+      while (!stop) {
+        for (int key = -1000; key < 0; key += 7) assert(shared.contains(key));
+      }
+    });
+  }
+  // every write publishes a copy of the table, so far fewer keys than usual
+  check_concurrent(shared, 100);
+  stop = true;
+  for (auto& th : readers) th.join();
+  assert(shared.size() == 1000 + THREADS * 100 / 2);
+}
+
+// cuckoo_adaptive against std::unordered_set across forced migrations, then
+// hammered from several threads with the sampling turned up so that it
+// migrates on its own.
+void test_adaptive(){
+  std::mt19937 rng;
+  cuckoo_adaptive<int> table;
+  std::unordered_set<int> refSet;
+  for (int round = 0; round < 4; ++round) {
+    check_ops(table, refSet, rng, 5000, 5000);
+    table.switch_to(table.mode() == adaptive_mode::sequential ? adaptive_mode::striped
+                                                              : adaptive_mode::sequential);
+  }
+  assert(table.migrations() == 4);
+  assert(table.size() == refSet.size());
+  for (int key : refSet) assert(table.contains(key));
+
+  cuckoo_adaptive<int>::configure_adaptation(16, 4, 0);
+  cuckoo_adaptive<int> shared;
+  shared.add(-1); // for erase_if() below to visit
+  std::atomic<int> started{0};
+  check_concurrent(shared, KEYS, [&](int t){
+    started++;
+    if (t != 0) return;
+    // hold the sequential table's mutex while the others start, so they
+    // find it taken even without preemption on a single core
+    std::atomic<bool> held{false};
+    shared.erase_if([&](int){
+      if (!held.exchange(true)) {
+        while (started < THREADS) std::this_thread::yield();
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      }
+      return false;
+    });
+  });
+  // with an upgrade threshold of 0 the first contended window upgrades
+  assert(shared.migrations() > 0);
+  cuckoo_adaptive<int>::configure_adaptation(256, 64, 1);
+}
+
+// An int set engine against std::unordered_set, with contains_batch() and
+// erase_if() where it has them, then from several threads adding and removing
+// keys of their own. make() returns an empty table.
+template<typename Table, typename Make>
+void check_baseline(Make make){
+  std::mt19937 rng;
+  Table table = make();
+  std::unordered_set<int> refSet;
+  check_ops(table, refSet, rng, 20000, 5000);
+  if constexpr (requires (std::span<const int> keys, std::span<bool> found){
+                  table.contains_batch(keys, found); }) {
+    std::vector<int> keys;
+    for (int key = 0; key < 5000; ++key) keys.push_back(key);
+    std::unique_ptr<bool[]> found(new bool[keys.size()]);
+    table.contains_batch(std::span<const int>(keys), std::span<bool>(found.get(), keys.size()));
+    for (int key : keys) assert(found[key] == (refSet.count(key) > 0));
+  }
+  auto odd = [](int k){ return k % 2 == 1; };
+  if constexpr (requires { table.erase_if(odd); }) {
+    assert(table.erase_if(odd) == std::erase_if(refSet, odd));
+    assert(table.size() == refSet.size());
+  }
+  assert(table.memory_usage().total() > 0);
+
+  Table shared = make();
+  check_concurrent(shared);
+}
+
+template<typename Table>
+void check_baseline(){
+  check_baseline<Table>([]{ return Table(4); });
+}
+
+void test_baselines(){
+  check_baseline<cuckoo_sharded<int>>();
+  check_baseline<locked_set<int>>();
+  check_baseline<locked_set<int, std::mutex>>();
+  check_baseline<cuckoo_adaptive<int>>();
+  check_baseline<cuckoo_hopscotch<int>>();
+  check_baseline<filtered_set<cuckoo_striped<int>>>([]{
+    return filtered_set<cuckoo_striped<int>>(5000);
+  });
+  cuckoo_sharded<int> sharded(1 << 16);
+  assert(sharded.bucket_count() == 1 << 16);
+}
+
+// cuckoo_hopscotch against std::unordered_set, with a neighborhood and add
+// range small enough that keys are hopped and the table resizes from full
+// neighborhoods, then from several threads adding and removing keys of their
+// own while it grows.
+template<typename Slots, typename MakeKey>
+void check_hopscotch(MakeKey make_key){
+  using Key = decltype(make_key(0));
+  using Table = cuckoo_hopscotch<Key, bucket_allocator<Key>, Slots>;
+  std::mt19937 rng;
+  Table::configure(4, 16);
+  Table table(4);
+  std::unordered_set<Key> refSet;
+  check_ops(table, refSet, rng, 40000, 8000, make_key);
+  for (const Key& key : refSet) assert(table.contains(key));
+  auto expired = [](const Key& k){ return std::hash<Key>()(k) % 3 == 0; };
+  assert(table.erase_if(expired) == std::erase_if(refSet, expired));
+  assert(table.size() == refSet.size());
+  for (int k = 0; k < 8000; ++k) assert(table.contains(make_key(k)) == (refSet.count(make_key(k)) > 0));
+  Table::configure(8, 128);
+}
+
+void test_hopscotch(){
+  check_hopscotch<optional_slots<int>>([](int k){ return k; });
+  check_hopscotch<empty_key<int, -1>>([](int k){ return k; });
+  check_hopscotch<optional_slots<std::string>>([](int k){ return "key" + std::to_string(k); });
+  cuckoo_hopscotch<int, bucket_allocator<int>, empty_key<int, -1>> raw;
+  bool threw = false;
+  try { raw.add(-1); } catch (const std::invalid_argument&) { threw = true; }
+  assert(threw && !raw.contains(-1) && !raw.remove(-1));
+
+  cuckoo_hopscotch<int>::configure(4, 16);
+  cuckoo_hopscotch<int> shared;
+  assert(shared.neighborhood() == 4);
+  check_concurrent(shared);
+  for (int key = 0; key < THREADS * KEYS; key += 2) assert(!shared.contains(key));
+  assert(shared.bucket_count() >= THREADS * KEYS / 2);
+  cuckoo_hopscotch<int>::configure(8, 128);
+}
+
+// Callers from outside the pool share its last deque, and while waiting each
+// may only run tasks of its own parallel_for().
+void test_task_pool(){
+  task_pool pool(3);
+  static thread_local int waiting_on = 0;
+  std::vector<std::thread> callers;
+  for (int c = 1; c <= THREADS; ++c) {
+    callers.emplace_back([&pool, c]{
+      for (int round = 0; round < 50; ++round) {
+        std::vector<int> hits(1000);
+        waiting_on = c;
+        pool.parallel_for(0, hits.size(), 10, [&hits, c](size_t b, size_t e){
+          assert(waiting_on == 0 || waiting_on == c);
+          for (size_t i = b; i < e; ++i) hits[i]++;
+          std::this_thread::yield();
+        });
+        waiting_on = 0;
+        for (int h : hits) assert(h == 1);
+      }
+    });
+  }
+  for (auto& th : callers) th.join();
+}
+
 int main() {
   test_ints();
   test_strings();
   test_user_defined_class();
+  test_aligned_keys();
+  test_move_only_keys();
+  test_empty_key();
+  test_tx_batch();
+  test_counter();
+  test_filter();
+  test_rcu();
+  test_adaptive();
+  test_memory_usage();
+  test_baselines();
+  test_hopscotch();
+  test_task_pool();
   std::cout << "Sequential correctness tests pass" << std::endl;
   return 0;
 }
\ No newline at end of file
@@ -6,10 +6,29 @@
 #include <chrono>
 #include <atomic>
 #include <iomanip>
+#include <limits>
+#include <string>
+#include <fstream>
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <span>
+#include <unordered_map>
+#include "cuckoo_adaptive.h"
+#include "cuckoo_counter.h"
+#include "cuckoo_filter.h"
+#include "cuckoo_hopscotch.h"
+#include "cuckoo_rcu.h"
 #include "cuckoo_seq.h"
+#include "cuckoo_sharded.h"
 #include "cuckoo_striped.h"
 #include "cuckoo_refinable.h"
 #include "cuckoo_tx.h"
+#include "locked_set.h"
+#include "cpu_topology.h"
+#include "latency_histogram.h"
+#include "op_trace.h"
 
 using namespace std;
 using namespace cuckoo;
@@ -18,6 +37,17 @@ constexpr int NUM_KEYS = 500000;
 constexpr int MAX_KEY = 1000000;
 constexpr int NUM_OPS = 10000000;
 constexpr int NUM_THREADS = 16;
+constexpr int STALL_KEYS = 16000000;
+constexpr int STALL_WINDOW_MS = 10;
+constexpr int SCALING_RUNS = 5;
+constexpr size_t HOPSCOTCH_ADD_RANGE = 128;
+
+// cuckoo_hopscotch as benchmarked: raw int slots, INT_MIN marking empty
+// ones, so a bucket is 8 bytes and the default neighborhood of 8 fits in at
+// most two cache lines. With optional<int> slots a bucket is 12 bytes.
+using hopscotch_int = cuckoo_hopscotch<int, bucket_allocator<int>, empty_key<int, numeric_limits<int>::min()>>;
+
+int num_ops = NUM_OPS;
 
 // Helper to generate random integers
 vector<int> random_ints(int count, int maxValue) {
@@ -70,7 +100,7 @@ double benchmark_seq(Table& table,
                      double r, double i, double d) {
     table.populate(const_cast<vector<int>&>(initVals));
     Timer t;
-    mixed_operations(table, NUM_OPS, r, i, d);
+    mixed_operations(table, num_ops, r, i, d);
     return t.elapsed_ms();
 }
 
@@ -84,34 +114,1174 @@ double benchmark_concurrent(Table& table,
     vector<thread> threads;
     for (int iTh = 0; iTh < NUM_THREADS; ++iTh) {
         threads.emplace_back([&table, r, i, d]() {
-            mixed_operations(table, NUM_OPS / NUM_THREADS, r, i, d);
+            mixed_operations(table, num_ops / NUM_THREADS, r, i, d);
+        });
+    }
+    for (auto& th : threads) th.join();
+    return t.elapsed_ms();
+}
+
+constexpr double READ_RATIO = 0.80;
+constexpr double INSERT_RATIO = 0.10;
+constexpr double REMOVE_RATIO = 0.10;
+
+// The 80/10/10 workload on numThreads threads, numOps in total. Returns wall
+// time in ms.
+template<typename Table>
+double phase_run(Table& table, int numThreads, int numOps) {
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, numThreads, numOps]() {
+            mixed_operations(table, numOps / numThreads, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+        });
+    }
+    for (auto& th : threads) th.join();
+    return t.elapsed_ms();
+}
+
+// Same workload as mixed_operations, but every operation is timed and
+// recorded into the calling thread's histograms.
+template<typename Table>
+void timed_operations(Table& table, int numOps, bench::latency_recorder& rec,
+                      double read_ratio, double insert_ratio) {
+    mt19937 rng(random_device{}());
+    uniform_int_distribution<int> keyDist(0, MAX_KEY);
+    uniform_real_distribution<double> opDist(0.0, 1.0);
+
+    for (int i = 0; i < numOps; ++i) {
+        double op = opDist(rng);
+        int key = keyDist(rng);
+        if (op < read_ratio) {
+            rec.time(bench::OP_CONTAINS, [&] { return table.contains(key); });
+        } else if (op < read_ratio + insert_ratio) {
+            rec.time(bench::OP_ADD, [&] { return table.add(key); });
+        } else {
+            rec.time(bench::OP_REMOVE, [&] { return table.remove(key); });
+        }
+    }
+}
+
+// Runs the mixed workload on a fresh table with numThreads workers and
+// returns the merged per-operation histograms.
+template<typename Table>
+bench::latency_recorder latency_run(size_t capacity, const vector<int>& initVals, int numThreads) {
+    Table table(capacity);
+    table.populate(const_cast<vector<int>&>(initVals));
+    vector<bench::latency_recorder> recs(numThreads);
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, &recs, iTh, numThreads]() {
+            timed_operations(table, num_ops / numThreads, recs[iTh], READ_RATIO, INSERT_RATIO);
+        });
+    }
+    for (auto& th : threads) th.join();
+
+    bench::latency_recorder merged;
+    for (auto& rec : recs) merged.merge(rec);
+    return merged;
+}
+
+void print_latency_rows(const string& name, int threads, const bench::latency_recorder& rec) {
+    for (int op = 0; op < bench::NUM_OP_TYPES; ++op) {
+        const bench::latency_histogram& h = rec.hist[op];
+        cout << left << setw(20) << name
+             << setw(10) << threads
+             << setw(10) << bench::op_name(op)
+             << setw(12) << h.count()
+             << setw(10) << h.percentile(50)
+             << setw(10) << h.percentile(90)
+             << setw(10) << h.percentile(99)
+             << setw(10) << h.percentile(99.9)
+             << setw(12) << h.max()
+             << endl;
+    }
+}
+
+void run_latency(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Per-Operation Latency (ns) ===" << endl;
+    cout << "Workload: R/I/D = 80/10/10, Ops = " << num_ops << endl << endl;
+
+    cout << left << setw(20) << "Table Type"
+         << setw(10) << "Threads"
+         << setw(10) << "Op"
+         << setw(12) << "Count"
+         << setw(10) << "p50"
+         << setw(10) << "p90"
+         << setw(10) << "p99"
+         << setw(10) << "p99.9"
+         << setw(12) << "max"
+         << endl;
+    cout << string(20 + 10 + 10 + 12 + 10 * 4 + 12, '-') << endl;
+
+    print_latency_rows("cuckoo_seq", 1, latency_run<cuckoo_seq<int>>(initial_capacity, initVals, 1));
+    for (int threads = 1; threads <= NUM_THREADS; threads *= 2) {
+        print_latency_rows("cuckoo_striped", threads,
+                           latency_run<cuckoo_striped<int>>(initial_capacity, initVals, threads));
+        print_latency_rows("cuckoo_refinable", threads,
+                           latency_run<cuckoo_refinable<int>>(initial_capacity, initVals, threads));
+        print_latency_rows("cuckoo_tx", threads,
+                           latency_run<cuckoo_tx<int>>(initial_capacity, initVals, threads));
+        print_latency_rows("cuckoo_hopscotch", threads,
+                           latency_run<hopscotch_int>(initial_capacity, initVals, threads));
+        print_latency_rows("cuckoo_sharded", threads,
+                           latency_run<cuckoo_sharded<int>>(initial_capacity, initVals, threads));
+        print_latency_rows("locked_set", threads,
+                           latency_run<locked_set<int>>(initial_capacity, initVals, threads));
+    }
+    cout << string(20 + 10 + 10 + 12 + 10 * 4 + 12, '-') << endl;
+}
+
+void print_stats(const string& name, const cuckoo_stats& s) {
+    cout << left << setw(20) << name
+         << setw(12) << s.inserts
+         << setw(12) << s.displacements
+         << setw(10) << s.max_path
+         << setw(12) << s.relocation_failures
+         << setw(10) << s.resizes
+         << setw(14) << fixed << setprecision(2) << s.resize_ns / 1e6
+         << setw(14) << s.resize_wait_ns / 1e6
+         << setw(14) << s.lock_retries
+         << setw(12) << s.tx_retries
+         << endl;
+}
+
+// Runs the default workload once per engine and prints its counters.
+void run_stats(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Engine Instrumentation ===" << endl;
+    if (!stats_enabled) {
+        cout << "Counters are compiled out; rebuild with make STATS=1" << endl;
+        return;
+    }
+    cout << "Workload: R/I/D = 80/10/10, Threads = " << NUM_THREADS << endl << endl;
+
+    cout << left << setw(20) << "Table Type"
+         << setw(12) << "Inserts"
+         << setw(12) << "Displaced"
+         << setw(10) << "MaxPath"
+         << setw(12) << "RelocFail"
+         << setw(10) << "Resizes"
+         << setw(14) << "Resize (ms)"
+         << setw(14) << "Wait (ms)"
+         << setw(14) << "LockRetries"
+         << setw(12) << "TxRetries"
+         << endl;
+    cout << string(20 + 12 * 3 + 10 * 2 + 14 * 3 + 12, '-') << endl;
+
+    cuckoo_seq<int> seq(initial_capacity);
+    benchmark_seq(seq, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+    print_stats("cuckoo_seq", seq.stats());
+
+    cuckoo_striped<int> striped(initial_capacity);
+    benchmark_concurrent(striped, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+    print_stats("cuckoo_striped", striped.stats());
+
+    cuckoo_refinable<int> refinable(initial_capacity);
+    benchmark_concurrent(refinable, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+    print_stats("cuckoo_refinable", refinable.stats());
+
+    cuckoo_tx<int> tx(initial_capacity);
+    benchmark_concurrent(tx, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+    print_stats("cuckoo_tx", tx.stats());
+
+    hopscotch_int hopscotch(initial_capacity);
+    benchmark_concurrent(hopscotch, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+    print_stats("cuckoo_hopscotch", hopscotch.stats());
+
+    cuckoo_sharded<int> sharded(initial_capacity);
+    benchmark_concurrent(sharded, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+    print_stats("cuckoo_sharded", sharded.stats());
+    cout << string(20 + 12 * 3 + 10 * 2 + 14 * 3 + 12, '-') << endl;
+    cout << "(locked_set keeps no counters)" << endl;
+}
+
+// ---- Resize stall timeline ----
+
+struct stall_window {
+    double t_ms;
+    uint64_t reads;
+    uint64_t writes;
+};
+
+struct resize_event {
+    double start_ms;
+    double end_ms;
+    size_t old_buckets;
+    size_t new_buckets;
+};
+
+struct alignas(64) padded_counter {
+    atomic<uint64_t> value{0};
+};
+
+// One writer grows the table from 16 buckets to numKeys keys while the
+// remaining threads look up keys already inserted. A monitor samples the
+// op counters every STALL_WINDOW_MS; the writer marks every add() that
+// changed bucket_count(), which is exactly the add() that ran the resize.
+template<typename Table>
+void stall_run(const string& name, int numKeys, int numReaders) {
+    Table table(16);
+    vector<padded_counter> reads(numReaders);
+    padded_counter writes;
+    atomic<int> inserted{0};
+    atomic<bool> done{false};
+    vector<stall_window> windows;
+    vector<resize_event> resizes;
+    auto start = chrono::steady_clock::now();
+    auto since_start = [&start] {
+        return chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    };
+
+    thread monitor([&] {
+        auto next = start;
+        while (!done.load()) {
+            next += chrono::milliseconds(STALL_WINDOW_MS);
+            this_thread::sleep_until(next);
+            uint64_t r = 0;
+            for (auto& c : reads) r += c.value.load(memory_order_relaxed);
+            windows.push_back({since_start(), r, writes.value.load(memory_order_relaxed)});
+        }
+    });
+
+    vector<thread> readers;
+    for (int iTh = 0; iTh < numReaders; ++iTh) {
+        readers.emplace_back([&, iTh] {
+            mt19937 rng(iTh);
+            while (!done.load(memory_order_relaxed)) {
+                int n = inserted.load(memory_order_relaxed);
+                if (n == 0) continue;
+                table.contains(static_cast<int>(rng() % n));
+                reads[iTh].value.fetch_add(1, memory_order_relaxed);
+            }
+        });
+    }
+
+    for (int k = 0; k < numKeys; ++k) {
+        size_t before = table.bucket_count();
+        double t0 = since_start();
+        table.add(k);
+        size_t after = table.bucket_count();
+        if (after != before) resizes.push_back({t0, since_start(), before, after});
+        inserted.store(k + 1, memory_order_relaxed);
+        writes.value.fetch_add(1, memory_order_relaxed);
+    }
+    double total_ms = since_start();
+    done = true;
+    for (auto& th : readers) th.join();
+    monitor.join();
+
+    // Per-window throughput, with the resizes overlapping each window marked
+    string file = "stall_" + name + ".csv";
+    ofstream csv(file);
+    csv << "t_ms,reads_per_ms,writes_per_ms,resize" << endl;
+    vector<double> rates;
+    for (size_t w = 0; w < windows.size(); ++w) {
+        double t0 = (w == 0) ? 0 : windows[w - 1].t_ms;
+        uint64_t r0 = (w == 0) ? 0 : windows[w - 1].reads;
+        uint64_t w0 = (w == 0) ? 0 : windows[w - 1].writes;
+        double dt = windows[w].t_ms - t0;
+        double rate = (numReaders ? windows[w].reads - r0 : windows[w].writes - w0) / dt;
+        rates.push_back(rate);
+        csv << fixed << setprecision(2) << windows[w].t_ms << ","
+            << (windows[w].reads - r0) / dt << "," << (windows[w].writes - w0) / dt << ",";
+        for (auto& e : resizes) {
+            if (e.start_ms < windows[w].t_ms && e.end_ms > t0)
+                csv << e.old_buckets << "->" << e.new_buckets << " ";
+        }
+        csv << endl;
+    }
+
+    vector<double> sorted = rates;
+    sort(sorted.begin(), sorted.end());
+    double median = sorted.empty() ? 0 : sorted[sorted.size() / 2];
+
+    cout << name << ": " << numKeys << " keys in " << fixed << setprecision(2) << total_ms
+         << " ms, median " << median << (numReaders ? " reads" : " writes")
+         << "/ms, timeline in " << file << endl;
+    cout << "  " << left << setw(24) << "Resize (buckets)"
+         << setw(14) << "Start (ms)"
+         << setw(14) << "Stall (ms)"
+         << setw(18) << "Min window (/ms)"
+         << setw(10) << "Depth"
+         << endl;
+    double total_stall = 0;
+    for (auto& e : resizes) {
+        double min_rate = median;
+        for (size_t w = 0; w < windows.size(); ++w) {
+            double t0 = (w == 0) ? 0 : windows[w - 1].t_ms;
+            if (e.start_ms < windows[w].t_ms && e.end_ms > t0) min_rate = min(min_rate, rates[w]);
+        }
+        double depth = median > 0 ? 100.0 * (1.0 - min_rate / median) : 0;
+        total_stall += e.end_ms - e.start_ms;
+        cout << "  " << setw(24) << (to_string(e.old_buckets) + "->" + to_string(e.new_buckets))
+             << setw(14) << e.start_ms
+             << setw(14) << e.end_ms - e.start_ms
+             << setw(18) << min_rate
+             << setw(10) << (to_string(static_cast<int>(depth)) + "%")
+             << endl;
+    }
+    cout << "  total stall " << total_stall << " ms over " << resizes.size() << " resizes" << endl << endl;
+}
+
+void run_stall(int numKeys) {
+    cout << "\n=== Resize Stall Timeline ===" << endl;
+    cout << "Growing from 16 buckets to " << numKeys << " keys, 1 writer + "
+         << NUM_THREADS - 1 << " readers, " << STALL_WINDOW_MS << " ms windows" << endl;
+    cout << "(cuckoo_seq runs the writer alone)" << endl << endl;
+    stall_run<cuckoo_seq<int>>("cuckoo_seq", numKeys, 0);
+    stall_run<cuckoo_striped<int>>("cuckoo_striped", numKeys, NUM_THREADS - 1);
+    stall_run<cuckoo_refinable<int>>("cuckoo_refinable", numKeys, NUM_THREADS - 1);
+    stall_run<cuckoo_tx<int>>("cuckoo_tx", numKeys, NUM_THREADS - 1);
+    stall_run<hopscotch_int>("cuckoo_hopscotch", numKeys, NUM_THREADS - 1);
+    stall_run<cuckoo_sharded<int>>("cuckoo_sharded", numKeys, NUM_THREADS - 1);
+    stall_run<locked_set<int>>("locked_set", numKeys, NUM_THREADS - 1);
+}
+
+// ---- Counting ----
+
+constexpr int HOT_KEYS = 64;
+constexpr double HOT_RATIO = 0.90;
+
+// The status quo cuckoo_counter replaces: one lock around a map.
+struct locked_map_counter {
+    mutex mtx;
+    unordered_map<int, uint64_t> counts;
+
+    uint64_t increment(int key, uint64_t delta = 1) {
+        unique_lock<mutex> lock(mtx);
+        return counts[key] += delta;
+    }
+};
+
+// Every thread counts keys drawn HOT_RATIO of the time from HOT_KEYS hot
+// keys and otherwise from [0, MAX_KEY]. Returns wall time in ms.
+template<typename Counter>
+double counting_run(Counter& counter, int numThreads) {
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&counter, iTh, numThreads]() {
+            mt19937 rng(iTh);
+            uniform_int_distribution<int> keyDist(0, MAX_KEY);
+            uniform_real_distribution<double> hotDist(0.0, 1.0);
+            for (int i = 0; i < num_ops / numThreads; ++i) {
+                int key = hotDist(rng) < HOT_RATIO ? keyDist(rng) % HOT_KEYS : keyDist(rng);
+                counter.increment(key);
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    return t.elapsed_ms();
+}
+
+void run_counting(size_t initial_capacity) {
+    cout << "\n=== Counting (increment) ===" << endl;
+    cout << "Workload: " << static_cast<int>(HOT_RATIO * 100) << "% of increments on "
+         << HOT_KEYS << " hot keys, Ops = " << num_ops << endl << endl;
+
+    cout << left << setw(10) << "Threads"
+         << setw(20) << "cuckoo_counter (ms)"
+         << setw(20) << "locked map (ms)"
+         << endl;
+    cout << string(10 + 20 + 20, '-') << endl;
+    for (int threads = 1; threads <= NUM_THREADS; threads *= 2) {
+        cuckoo_counter<int> counter(initial_capacity);
+        locked_map_counter map;
+        double counter_t = counting_run(counter, threads);
+        double map_t = counting_run(map, threads);
+        cout << fixed << setprecision(2)
+             << setw(10) << threads
+             << setw(20) << counter_t
+             << setw(20) << map_t
+             << endl;
+    }
+    cout << string(10 + 20 + 20, '-') << endl;
+}
+
+// The 80/10/10 workload on cuckoo_tx, handed to run_batch() BATCH_OPS ops at
+// a time instead of one call per op. Returns wall time in ms.
+constexpr size_t BATCH_OPS = 256;
+
+double batched_run(cuckoo_tx<int>& table, int numThreads) {
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, iTh, numThreads]() {
+            mt19937 rng(iTh);
+            uniform_int_distribution<int> keyDist(0, MAX_KEY);
+            uniform_real_distribution<double> opDist(0.0, 1.0);
+            vector<tx_op<int>> ops(BATCH_OPS);
+            unique_ptr<bool[]> results(new bool[BATCH_OPS]);
+            for (int done = 0; done < num_ops / numThreads; done += BATCH_OPS) {
+                for (tx_op<int>& op : ops) {
+                    double r = opDist(rng);
+                    op.kind = r < READ_RATIO ? tx_op_kind::contains
+                            : r < READ_RATIO + INSERT_RATIO ? tx_op_kind::add
+                            : tx_op_kind::remove;
+                    op.key = keyDist(rng);
+                }
+                table.run_batch(ops, span<bool>(results.get(), BATCH_OPS));
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    return t.elapsed_ms();
+}
+
+void run_batch_mode(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Batched transactions (cuckoo_tx) ===" << endl;
+    cout << "Workload: R/I/D = 80/10/10, " << BATCH_OPS << " ops per run_batch(), Ops = "
+         << num_ops << endl << endl;
+
+    cout << left << setw(10) << "Threads"
+         << setw(16) << "Per-op (ms)"
+         << setw(16) << "Batched (ms)"
+         << setw(12) << "Speedup"
+         << setw(12) << "Batch size"
+         << setw(16) << "Sharded (ms)"
+         << setw(16) << "Locked (ms)"
+         << endl;
+    cout << string(10 + 16 + 16 + 12 + 12 + 16 + 16, '-') << endl;
+    for (int threads = 1; threads <= NUM_THREADS; threads *= 2) {
+        cuckoo_tx<int> per_op(initial_capacity);
+        per_op.populate(const_cast<vector<int>&>(initVals));
+        double per_op_t = phase_run(per_op, threads, num_ops);
+
+        cuckoo_tx<int> batched(initial_capacity);
+        batched.populate(const_cast<vector<int>&>(initVals));
+        double batched_t = batched_run(batched, threads);
+
+        // the baselines run the same workload one op per call
+        cuckoo_sharded<int> sharded(initial_capacity);
+        sharded.populate(const_cast<vector<int>&>(initVals));
+        double sharded_t = phase_run(sharded, threads, num_ops);
+        locked_set<int> locked(initial_capacity);
+        locked.populate(const_cast<vector<int>&>(initVals));
+        double locked_t = phase_run(locked, threads, num_ops);
+        cout << fixed << setprecision(2)
+             << setw(10) << threads
+             << setw(16) << per_op_t
+             << setw(16) << batched_t
+             << setw(12) << per_op_t / batched_t
+             << setw(12) << batched.batch_size()
+             << setw(16) << sharded_t
+             << setw(16) << locked_t
+             << endl;
+    }
+    cout << string(10 + 16 + 16 + 12 + 12 + 16 + 16, '-') << endl;
+}
+
+// Lookups only, MISS_RATIO of them for keys above MAX_KEY that were never
+// added. Returns wall time in ms.
+constexpr double MISS_RATIO = 0.90;
+
+template<typename Table>
+double lookup_run(Table& table, int numThreads) {
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, iTh, numThreads]() {
+            mt19937 rng(iTh);
+            uniform_int_distribution<int> keyDist(0, MAX_KEY);
+            uniform_real_distribution<double> missDist(0.0, 1.0);
+            size_t found = 0;
+            for (int i = 0; i < num_ops / numThreads; ++i) {
+                int key = keyDist(rng);
+                if (missDist(rng) < MISS_RATIO) key += MAX_KEY + 1;
+                found += table.contains(key);
+            }
+            volatile size_t sink = found;
+            (void) sink;
+        });
+    }
+    for (auto& th : threads) th.join();
+    return t.elapsed_ms();
+}
+
+template<typename Table>
+void filter_row(const string& name, size_t initial_capacity, const vector<int>& initVals) {
+    Table plain(initial_capacity);
+    plain.populate(const_cast<vector<int>&>(initVals));
+    filtered_set<Table> filtered(initVals.size(), initial_capacity);
+    filtered.populate(const_cast<vector<int>&>(initVals));
+    double plain_t = lookup_run(plain, NUM_THREADS);
+    double filtered_t = lookup_run(filtered, NUM_THREADS);
+    cout << fixed << setprecision(2)
+         << setw(14) << name
+         << setw(16) << plain_t
+         << setw(16) << filtered_t
+         << setw(12) << plain_t / filtered_t
+         << endl;
+}
+
+void run_filter(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Cuckoo filter pre-check ===" << endl;
+    cout << "Workload: contains only, " << static_cast<int>(MISS_RATIO * 100)
+         << "% misses, Threads = " << NUM_THREADS << ", Ops = " << num_ops << endl;
+
+    cuckoo_filter<int> filter(initVals.size());
+    for (int key : initVals) filter.add(key);
+    int false_positives = 0;
+    constexpr int PROBES = 1000000;
+    for (int key = MAX_KEY + 1; key <= MAX_KEY + PROBES; ++key) false_positives += filter.contains(key);
+    cout << "Filter: " << filter.bucket_count() * cuckoo_filter<int>::SLOTS * sizeof(uint16_t) / 1024
+         << " KiB, load " << setprecision(3)
+         << double(filter.size()) / (filter.bucket_count() * cuckoo_filter<int>::SLOTS)
+         << ", false positive rate " << setprecision(4) << 100.0 * false_positives / PROBES
+         << "%" << endl << endl;
+
+    cout << left << setw(14) << "Engine"
+         << setw(16) << "Plain (ms)"
+         << setw(16) << "Filtered (ms)"
+         << setw(12) << "Speedup"
+         << endl;
+    cout << string(14 + 16 + 16 + 12, '-') << endl;
+    filter_row<cuckoo_striped<int>>("Striped", initial_capacity, initVals);
+    filter_row<cuckoo_refinable<int>>("Refinable", initial_capacity, initVals);
+    filter_row<cuckoo_tx<int>>("Tx", initial_capacity, initVals);
+    filter_row<hopscotch_int>("Hopscotch", initial_capacity, initVals);
+    filter_row<cuckoo_sharded<int>>("Sharded", initial_capacity, initVals);
+    filter_row<locked_set<int>>("Locked set", initial_capacity, initVals);
+    cout << string(14 + 16 + 16 + 12, '-') << endl;
+}
+
+// Read-mostly workload on cuckoo_rcu. Lookups go to the table one by one;
+// each thread buffers its adds and removes and hands them over WRITE_BATCH
+// at a time through update(), as a bulk loader would. Returns wall time in
+// ms.
+constexpr size_t WRITE_BATCH = 4096;
+
+double rcu_run(cuckoo_rcu<int>& table, int numThreads, double read_ratio) {
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, iTh, numThreads, read_ratio]() {
+            mt19937 rng(iTh);
+            uniform_int_distribution<int> keyDist(0, MAX_KEY);
+            uniform_real_distribution<double> opDist(0.0, 1.0);
+            vector<pair<bool, int>> writes;
+            auto flush = [&]() {
+                table.update([&](cuckoo_seq<int>& next) {
+                    for (auto& [is_add, key] : writes) {
+                        if (is_add) next.add(key); else next.remove(key);
+                    }
+                });
+                writes.clear();
+            };
+            for (int i = 0; i < num_ops / numThreads; ++i) {
+                double op = opDist(rng);
+                int key = keyDist(rng);
+                if (op < read_ratio) {
+                    table.contains(key);
+                } else {
+                    writes.push_back({op < read_ratio + (1 - read_ratio) / 2, key});
+                    if (writes.size() == WRITE_BATCH) flush();
+                }
+            }
+            if (!writes.empty()) flush();
+        });
+    }
+    for (auto& th : threads) th.join();
+    return t.elapsed_ms();
+}
+
+void run_rcu(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Read-optimized (cuckoo_rcu) vs striped ===" << endl;
+    cout << "Workload: writes split evenly between adds and removes, cuckoo_rcu writes in batches of "
+         << WRITE_BATCH << ", Threads = " << NUM_THREADS << ", Ops = " << num_ops << endl << endl;
+
+    cout << left << setw(10) << "Reads"
+         << setw(16) << "Striped (ms)"
+         << setw(14) << "RCU (ms)"
+         << setw(12) << "Speedup"
+         << setw(12) << "Versions"
+         << setw(16) << "Sharded (ms)"
+         << setw(16) << "Locked (ms)"
+         << endl;
+    cout << string(10 + 16 + 14 + 12 + 12 + 16 + 16, '-') << endl;
+    for (double read_ratio : {0.80, 0.95, 0.99}) {
+        double write_ratio = (1 - read_ratio) / 2;
+        cuckoo_striped<int> striped(initial_capacity);
+        double striped_t = benchmark_concurrent(striped, initVals, read_ratio, write_ratio, write_ratio);
+        cuckoo_rcu<int> rcu(initial_capacity);
+        rcu.populate(const_cast<vector<int>&>(initVals));
+        double rcu_t = rcu_run(rcu, NUM_THREADS, read_ratio);
+        cuckoo_sharded<int> sharded(initial_capacity);
+        double sharded_t = benchmark_concurrent(sharded, initVals, read_ratio, write_ratio, write_ratio);
+        // lookups share the lock: the usual read-mostly fallback
+        locked_set<int> locked(initial_capacity);
+        double locked_t = benchmark_concurrent(locked, initVals, read_ratio, write_ratio, write_ratio);
+        cout << fixed << setprecision(2)
+             << setw(10) << (to_string(static_cast<int>(read_ratio * 100)) + "%")
+             << setw(16) << striped_t
+             << setw(14) << rcu_t
+             << setw(12) << striped_t / rcu_t
+             << setw(12) << rcu.versions()
+             << setw(16) << sharded_t
+             << setw(16) << locked_t
+             << endl;
+    }
+    cout << string(10 + 16 + 14 + 12 + 12 + 16 + 16, '-') << endl;
+}
+
+const char* mode_name(adaptive_mode mode) {
+    return mode == adaptive_mode::sequential ? "seq" : "striped";
+}
+
+void run_adaptive(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Adaptive engine across phases ===" << endl;
+    cout << "Workload: R/I/D = 80/10/10, single-threaded, then " << NUM_THREADS
+         << " threads, then single-threaded again, Ops = " << num_ops << " per phase" << endl << endl;
+
+    cuckoo_seq<int> seq(initial_capacity);
+    cuckoo_striped<int> striped(initial_capacity);
+    cuckoo_adaptive<int> adaptive(initial_capacity);
+    cuckoo_sharded<int> sharded(initial_capacity);
+    locked_set<int> locked(initial_capacity);
+    seq.populate(const_cast<vector<int>&>(initVals));
+    striped.populate(const_cast<vector<int>&>(initVals));
+    adaptive.populate(const_cast<vector<int>&>(initVals));
+    sharded.populate(const_cast<vector<int>&>(initVals));
+    locked.populate(const_cast<vector<int>&>(initVals));
+
+    cout << left << setw(10) << "Threads"
+         << setw(12) << "Seq (ms)"
+         << setw(16) << "Striped (ms)"
+         << setw(16) << "Adaptive (ms)"
+         << setw(12) << "Mode"
+         << setw(12) << "Migrations"
+         << setw(16) << "Sharded (ms)"
+         << setw(16) << "Locked (ms)"
+         << endl;
+    cout << string(10 + 12 + 16 + 16 + 12 + 12 + 16 + 16, '-') << endl;
+    for (int threads : {1, NUM_THREADS, 1}) {
+        // cuckoo_seq only runs the single-threaded phases
+        double seq_t = threads == 1 ? phase_run(seq, 1, num_ops) : 0;
+        double striped_t = phase_run(striped, threads, num_ops);
+        double adaptive_t = phase_run(adaptive, threads, num_ops);
+        double sharded_t = phase_run(sharded, threads, num_ops);
+        double locked_t = phase_run(locked, threads, num_ops);
+        cout << fixed << setprecision(2) << setw(10) << threads;
+        if (threads == 1) cout << setw(12) << seq_t; else cout << setw(12) << "-";
+        cout << setw(16) << striped_t
+             << setw(16) << adaptive_t
+             << setw(12) << mode_name(adaptive.mode())
+             << setw(12) << adaptive.migrations()
+             << setw(16) << sharded_t
+             << setw(16) << locked_t
+             << endl;
+    }
+    cout << string(10 + 12 + 16 + 16 + 12 + 12 + 16 + 16, '-') << endl;
+}
+
+struct pinned_time {
+    double ms;
+    int unpinned; // workers whose pin_thread() failed
+};
+
+// The 80/10/10 workload on numThreads threads, worker i pinned to
+// cpus[i % cpus.size()]. Returns wall time in ms.
+template<typename Table>
+pinned_time pinned_run(Table& table, const vector<int>& cpus, int numThreads) {
+    atomic<int> unpinned{0};
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, &cpus, &unpinned, iTh, numThreads]() {
+            if (!bench::pin_thread(cpus[iTh % cpus.size()])) unpinned++;
+            mixed_operations(table, num_ops / numThreads, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+        });
+    }
+    for (auto& th : threads) th.join();
+    return {t.elapsed_ms(), unpinned.load()};
+}
+
+// The median of SCALING_RUNS pinned runs, each on a fresh table populated
+// with initVals; unpinned is summed over the runs.
+template<typename Table>
+pinned_time pinned_median(size_t initial_capacity, const vector<int>& initVals,
+                          const vector<int>& cpus, int numThreads) {
+    vector<double> ms;
+    int unpinned = 0;
+    for (int run = 0; run < SCALING_RUNS; ++run) {
+        Table table(initial_capacity);
+        table.populate(const_cast<vector<int>&>(initVals));
+        pinned_time r = pinned_run(table, cpus, numThreads);
+        ms.push_back(r.ms);
+        unpinned += r.unpinned;
+    }
+    sort(ms.begin(), ms.end());
+    return {ms[ms.size() / 2], unpinned};
+}
+
+void print_scaling_row(const string& name, int threads, pinned_time run, double seq_ms) {
+    double speedup = seq_ms / run.ms;
+    cout << fixed << setprecision(2)
+         << setw(20) << name
+         << setw(10) << threads
+         << setw(12) << run.ms
+         << setw(14) << static_cast<long long>(num_ops / (run.ms / 1000.0))
+         << setw(10) << speedup
+         << setw(12) << speedup / threads
+         << setw(10) << run.unpinned
+         << endl;
+}
+
+template<typename Table>
+void scaling_rows(const string& name, size_t initial_capacity, const vector<int>& initVals,
+                  const vector<int>& cpus, const vector<int>& counts, double seq_ms) {
+    for (int threads : counts)
+        print_scaling_row(name, threads, pinned_median<Table>(initial_capacity, initVals, cpus, threads), seq_ms);
+}
+
+void print_topology(const vector<bench::cpu_info>& cpus) {
+    set<int> packages, nodes;
+    set<pair<int, int>> cores;
+    for (const auto& c : cpus) {
+        packages.insert(c.package);
+        nodes.insert(c.node);
+        cores.insert({c.package, c.core});
+    }
+    cout << "Topology: " << cpus.size() << " hardware threads, " << cores.size() << " cores, "
+         << packages.size() << " packages, " << nodes.size() << " NUMA nodes" << endl;
+    cout << left << setw(8) << "CPU" << setw(10) << "Package" << setw(8) << "Node"
+         << setw(8) << "Core" << setw(8) << "SMT" << endl;
+    for (const auto& c : cpus) {
+        cout << setw(8) << c.cpu << setw(10) << c.package << setw(8) << c.node
+             << setw(8) << c.core << setw(8) << c.sibling << endl;
+    }
+}
+
+// Every engine from one thread to all hardware threads the process may use,
+// with workers pinned in compact or scatter order (see cpu_topology.h), or
+// both when placement is empty. Each row is the median of SCALING_RUNS runs.
+// Speedup is over cuckoo_seq on one pinned thread, efficiency is speedup per
+// thread, and Unpinned counts workers, over all runs, that could not be
+// pinned: a row where it is not 0 did not run in the placement asked for.
+void run_scaling(size_t initial_capacity, const vector<int>& initVals, const string& placement) {
+    vector<bench::cpu_info> topology = bench::cpu_topology();
+    int hw = static_cast<int>(topology.size());
+    vector<int> counts;
+    for (int threads = 1; threads < hw; threads *= 2) counts.push_back(threads);
+    counts.push_back(hw);
+
+    vector<bench::placement> placements;
+    for (bench::placement p : {bench::placement::compact, bench::placement::scatter}) {
+        if (placement.empty() || placement == bench::placement_name(p)) placements.push_back(p);
+    }
+    if (placements.empty()) {
+        cerr << "Unknown placement: " << placement << endl;
+        return;
+    }
+
+    cout << "\n=== Thread Scaling ===" << endl;
+    cout << "Workload: R/I/D = 80/10/10, Ops = " << num_ops << ", median of " << SCALING_RUNS
+         << " runs" << endl;
+    print_topology(topology);
+
+    for (bench::placement p : placements) {
+        vector<int> cpus = bench::placement_order(topology, p);
+        cout << "\nPlacement: " << bench::placement_name(p) << ", CPU order:";
+        for (int cpu : cpus) cout << " " << cpu;
+        cout << endl << endl;
+
+        pinned_time seq = pinned_median<cuckoo_seq<int>>(initial_capacity, initVals, cpus, 1);
+
+        cout << left << setw(20) << "Table Type"
+             << setw(10) << "Threads"
+             << setw(12) << "Time (ms)"
+             << setw(14) << "Ops/sec"
+             << setw(10) << "Speedup"
+             << setw(12) << "Efficiency"
+             << setw(10) << "Unpinned"
+             << endl;
+        cout << string(20 + 10 + 12 + 14 + 10 + 12 + 10, '-') << endl;
+        print_scaling_row("cuckoo_seq", 1, seq, seq.ms);
+        scaling_rows<cuckoo_striped<int>>("cuckoo_striped", initial_capacity, initVals, cpus, counts, seq.ms);
+        scaling_rows<cuckoo_refinable<int>>("cuckoo_refinable", initial_capacity, initVals, cpus, counts, seq.ms);
+        scaling_rows<cuckoo_tx<int>>("cuckoo_tx", initial_capacity, initVals, cpus, counts, seq.ms);
+        scaling_rows<hopscotch_int>("cuckoo_hopscotch", initial_capacity, initVals, cpus, counts, seq.ms);
+        scaling_rows<cuckoo_sharded<int>>("cuckoo_sharded", initial_capacity, initVals, cpus, counts, seq.ms);
+        scaling_rows<locked_set<int>>("locked_set", initial_capacity, initVals, cpus, counts, seq.ms);
+        cout << string(20 + 10 + 12 + 14 + 10 + 12 + 10, '-') << endl;
+    }
+}
+
+// Runs ops against table. Returns the lookups that hit, so none of them can
+// be optimized away.
+template<typename Table>
+size_t replay(Table& table, span<const bench::trace_record> ops) {
+    size_t hits = 0;
+    for (const bench::trace_record& r : ops) {
+        if (r.op == bench::OP_CONTAINS) hits += table.contains(r.key);
+        else if (r.op == bench::OP_ADD) table.add(r.key);
+        else table.remove(r.key);
+    }
+    return hits;
+}
+
+// The trace's ops on numThreads threads, each replaying its own slice.
+// Returns wall time in ms.
+template<typename Table>
+double replay_run(Table& table, const bench::mapped_trace& trace, int numThreads) {
+    atomic<size_t> hits{0};
+    Timer t;
+    vector<thread> threads;
+    for (int iTh = 0; iTh < numThreads; ++iTh) {
+        threads.emplace_back([&table, &trace, &hits, iTh, numThreads]() {
+            hits += replay(table, trace.slice(iTh, numThreads));
         });
     }
     for (auto& th : threads) th.join();
     return t.elapsed_ms();
 }
 
-int main() {
+// The trace's replay time next to the same number of operations drawn live,
+// as mixed_operations() does, from the same preloaded table.
+template<typename Table>
+void replay_row(const string& name, size_t initial_capacity, const bench::mapped_trace& trace,
+                int numThreads) {
+    Table replayed(initial_capacity);
+    replay(replayed, trace.preload());
+    double replay_ms = replay_run(replayed, trace, numThreads);
+    Table live(initial_capacity);
+    replay(live, trace.preload());
+    double live_ms = phase_run(live, numThreads, static_cast<int>(trace.ops().size()));
+    cout << fixed << setprecision(2)
+         << setw(20) << name
+         << setw(10) << numThreads
+         << setw(14) << replay_ms
+         << setw(16) << static_cast<long long>(trace.ops().size() / (replay_ms / 1000.0))
+         << setw(16) << live_ms
+         << endl;
+}
+
+void run_replay(const string& path) {
+    bench::mapped_trace trace(path);
+    cout << "\n=== Trace Replay ===" << endl;
+    cout << "Trace: " << path << ", " << trace.preload().size() << " preloaded keys, "
+         << trace.ops().size() << " ops" << endl << endl;
+
+    cout << left << setw(20) << "Table Type"
+         << setw(10) << "Threads"
+         << setw(14) << "Replay (ms)"
+         << setw(16) << "Ops/sec"
+         << setw(16) << "Live RNG (ms)"
+         << endl;
+    cout << string(20 + 10 + 14 + 16 + 16, '-') << endl;
     size_t initial_capacity = 1024;
-    cout << "Generating test data..." << endl;
-    auto initVals = random_ints(NUM_KEYS, MAX_KEY);
+    replay_row<cuckoo_seq<int>>("cuckoo_seq", initial_capacity, trace, 1);
+    replay_row<cuckoo_striped<int>>("cuckoo_striped", initial_capacity, trace, NUM_THREADS);
+    replay_row<cuckoo_refinable<int>>("cuckoo_refinable", initial_capacity, trace, NUM_THREADS);
+    replay_row<cuckoo_tx<int>>("cuckoo_tx", initial_capacity, trace, NUM_THREADS);
+    replay_row<hopscotch_int>("cuckoo_hopscotch", initial_capacity, trace, NUM_THREADS);
+    replay_row<cuckoo_sharded<int>>("cuckoo_sharded", initial_capacity, trace, NUM_THREADS);
+    replay_row<locked_set<int>>("locked_set", initial_capacity, trace, NUM_THREADS);
+    cout << string(20 + 10 + 14 + 16 + 16, '-') << endl;
+}
+
+// test_performance trace ... : writes a trace file, see main().
+int run_trace_tool(int argc, char** argv) {
+    string action = argc > 2 ? argv[2] : "";
+    if (action == "gen" && argc > 3) {
+        uint64_t ops = argc > 4 ? stoull(argv[4]) : NUM_OPS;
+        unsigned seed = argc > 5 ? stoul(argv[5]) : 1;
+        bench::generate_trace(argv[3], seed, NUM_KEYS, ops, READ_RATIO, INSERT_RATIO, MAX_KEY);
+        cout << "Wrote " << argv[3] << ": " << NUM_KEYS << " preloaded keys, " << ops
+             << " ops, seed " << seed << endl;
+        return 0;
+    }
+    if (action == "convert" && argc > 4) {
+        ifstream in(argv[3]);
+        if (!in) {
+            cerr << "Cannot read " << argv[3] << endl;
+            return 1;
+        }
+        uint64_t ops = bench::convert_log(in, argv[4]);
+        cout << "Wrote " << argv[4] << ": " << ops << " ops" << endl;
+        return 0;
+    }
+    cerr << "Usage: test_performance trace gen <file> [num_ops] [seed]" << endl
+         << "       test_performance trace convert <log> <file>" << endl;
+    return 1;
+}
+
+// Peak resident set of the process (VmHWM) in kB, 0 if unavailable.
+size_t peak_rss_kb() {
+    ifstream in("/proc/self/status");
+    for (string line; getline(in, line);) {
+        if (line.rfind("VmHWM:", 0) == 0) return stoul(line.substr(6));
+    }
+    return 0;
+}
+
+// Starts the peak over from the current resident set. False where the
+// kernel does not allow it, and the peak then covers the whole process.
+bool reset_peak_rss() {
+    ofstream out("/proc/self/clear_refs");
+    out << "5";
+    out.flush();
+    return out.good();
+}
+
+// Tables of bucket_count() buckets an engine has: two for the cuckoo
+// engines, one for cuckoo_hopscotch.
+template<typename Table>
+constexpr size_t tables_of = 2;
+template<typename Key, typename Alloc, typename Slots>
+constexpr size_t tables_of<cuckoo_hopscotch<Key, Alloc, Slots>> = 1;
+
+// The 80/10/10 workload on a fresh table, then what it holds. Load is
+// keys / (tables_of * buckets): the fraction of slots in use for the slot
+// engines, the mean probe-set length for the probe-set ones. Peak RSS
+// covers the run, on top of the keys the benchmark itself holds.
+template<typename Table>
+void memory_row(const string& name, size_t initial_capacity, const vector<int>& initVals, int numThreads) {
+    bool reset = reset_peak_rss();
+    double ms;
+    cuckoo_memory m;
+    size_t keys, buckets;
+    {
+        Table table(initial_capacity);
+        table.populate(const_cast<vector<int>&>(initVals));
+        ms = phase_run(table, numThreads, num_ops);
+        m = table.memory_usage();
+        keys = table.size();
+        buckets = table.bucket_count();
+    }
+    double per_key = 1.0 / max<size_t>(1, keys);
+    cout << fixed << setprecision(2)
+         << setw(20) << name
+         << setw(9) << numThreads
+         << setw(13) << static_cast<long long>(num_ops / (ms / 1000.0))
+         << setw(10) << keys
+         << setw(8) << double(keys) / (tables_of<Table> * buckets)
+         << setw(9) << m.total() * per_key
+         << setw(9) << m.table_bytes * per_key
+         << setw(9) << m.lock_bytes * per_key
+         << setw(10) << m.overflow_bytes * per_key
+         << setw(10) << peak_rss_kb() / 1024 << (reset ? "" : " (process)")
+         << endl;
+}
+
+void run_memory(size_t initial_capacity, const vector<int>& initVals) {
+    cout << "\n=== Memory Footprint ===" << endl;
+    cout << "Workload: R/I/D = 80/10/10, Ops = " << num_ops
+         << "; bytes are per key, from memory_usage()" << endl << endl;
+
+    cout << left << setw(20) << "Table Type"
+         << setw(9) << "Threads"
+         << setw(13) << "Ops/sec"
+         << setw(10) << "Keys"
+         << setw(8) << "Load"
+         << setw(9) << "B/key"
+         << setw(9) << "Table"
+         << setw(9) << "Locks"
+         << setw(10) << "Overflow"
+         << setw(10) << "Peak MB"
+         << endl;
+    cout << string(20 + 9 + 13 + 10 + 8 + 9 * 3 + 10 * 2, '-') << endl;
+    memory_row<cuckoo_seq<int>>("cuckoo_seq", initial_capacity, initVals, 1);
+    memory_row<cuckoo_striped<int>>("cuckoo_striped", initial_capacity, initVals, NUM_THREADS);
+    memory_row<cuckoo_refinable<int>>("cuckoo_refinable", initial_capacity, initVals, NUM_THREADS);
+    memory_row<cuckoo_tx<int>>("cuckoo_tx", initial_capacity, initVals, NUM_THREADS);
+    memory_row<cuckoo_adaptive<int>>("cuckoo_adaptive", initial_capacity, initVals, NUM_THREADS);
+    memory_row<hopscotch_int>("cuckoo_hopscotch", initial_capacity, initVals, NUM_THREADS);
+    memory_row<cuckoo_sharded<int>>("cuckoo_sharded", initial_capacity, initVals, NUM_THREADS);
+    memory_row<locked_set<int>>("locked_set", initial_capacity, initVals, NUM_THREADS);
+    // cuckoo_rcu is left out: the mixed workload copies its table on every
+    // write batch. Its footprint is a cuckoo_seq's, twice over during an
+    // update().
+    cout << string(20 + 9 + 13 + 10 + 8 + 9 * 3 + 10 * 2, '-') << endl;
+}
+
+// ---- Maximum load factor ----
+
+constexpr size_t MAXLOAD_CAPACITY = 1 << 14;
+constexpr size_t FILL_BANDS = 20;
+
+struct maxload_result {
+    size_t keys = 0;     // keys held when the next add forced a resize
+    size_t buckets = 0;
+    cuckoo_stats stats;  // of those keys' inserts
+    cuckoo_memory memory;
+    vector<bench::latency_histogram> bands; // add latency per 1/FILL_BANDS of keys
+};
+
+// Key i of every run: i times the 32-bit golden ratio, so all are distinct
+// and spread over the hash input.
+int maxload_key(size_t i) {
+    return static_cast<int>(static_cast<uint32_t>(i) * 0x9E3779B1u);
+}
+
+// Adds distinct keys to a table of `capacity` buckets on one thread until an
+// add changes bucket_count(), timing each add. The resizing add is not
+// counted. The same keys then go into a fresh table, which stops short of
+// the resize, for the counters and the footprint at the load reached.
+template<typename Table>
+maxload_result maxload_run(size_t capacity) {
+    maxload_result r;
+    vector<uint32_t> ns;
+    {
+        Table table(capacity);
+        size_t buckets = table.bucket_count();
+        for (size_t i = 0;; ++i) {
+            auto start = chrono::steady_clock::now();
+            table.add(maxload_key(i));
+            auto end = chrono::steady_clock::now();
+            if (table.bucket_count() != buckets) break;
+            ns.push_back(chrono::duration_cast<chrono::nanoseconds>(end - start).count());
+        }
+    }
+    r.keys = ns.size();
+    r.bands.resize(FILL_BANDS);
+    for (size_t i = 0; i < ns.size(); ++i) r.bands[i * FILL_BANDS / ns.size()].record(ns[i]);
+
+    Table full(capacity);
+    for (size_t i = 0; i < r.keys; ++i) full.add(maxload_key(i));
+    r.buckets = full.bucket_count();
+    r.stats = full.stats();
+    r.memory = full.memory_usage();
+    return r;
+}
+
+// Smallest displacement path length at or above the p-th percentile of
+// inserts; the last bucket stands for every longer path.
+string path_percentile(const cuckoo_stats& s, double p) {
+    uint64_t total = 0;
+    for (uint64_t n : s.path_hist) total += n;
+    uint64_t rank = max<uint64_t>(1, static_cast<uint64_t>(p / 100.0 * total + 0.5));
+    uint64_t seen = 0;
+    for (size_t len = 0; len < PATH_BUCKETS; ++len) {
+        seen += s.path_hist[len];
+        if (seen >= rank) return len == PATH_BUCKETS - 1 ? to_string(len) + "+" : to_string(len);
+    }
+    return "-";
+}
+
+// One row per configuration. Load is keys / (tables_of * buckets), as in
+// the memory mode; fill is keys over every slot the table could hold, with
+// slots_per_bucket keys per bucket (PROBE_SIZE for the probe-set engines).
+// Waste is the share of memory_usage() not taken by the keys themselves.
+// Insert latency is given over the first half of the keys and over the
+// last tenth; maxload.csv has it for each twentieth of them.
+template<typename Table>
+void maxload_row(const string& name, const string& config, size_t capacity, size_t slots_per_bucket,
+                 ofstream& csv) {
+    maxload_result r = maxload_run<Table>(capacity);
+    double load = double(r.keys) / (tables_of<Table> * r.buckets);
+    size_t key_bytes = r.keys * sizeof(int);
+    bench::latency_histogram first_half, last_tenth;
+    for (size_t b = 0; b < FILL_BANDS; ++b) {
+        if (b < FILL_BANDS / 2) first_half.merge(r.bands[b]);
+        if (b >= FILL_BANDS - FILL_BANDS / 10) last_tenth.merge(r.bands[b]);
+        csv << name << "," << config << "," << fixed << setprecision(3)
+            << load * (b + 1) / FILL_BANDS << "," << r.bands[b].percentile(50) << ","
+            << r.bands[b].percentile(99) << "," << r.bands[b].max() << endl;
+    }
+    cout << fixed << setprecision(2)
+         << setw(18) << name
+         << setw(20) << config
+         << setw(9) << r.keys
+         << setw(7) << load
+         << setw(7) << load / slots_per_bucket
+         << setw(8) << double(r.memory.total()) / max<size_t>(1, r.keys)
+         << setw(8) << (to_string(static_cast<int>(100.0 * (1.0 - double(key_bytes) / r.memory.total()))) + "%");
+    if (stats_enabled) {
+        cout << setw(6) << path_percentile(r.stats, 50)
+             << setw(6) << path_percentile(r.stats, 99)
+             << setw(6) << r.stats.max_path;
+    } else {
+        cout << setw(6) << "-" << setw(6) << "-" << setw(6) << "-";
+    }
+    cout << setw(9) << first_half.percentile(50)
+         << setw(9) << first_half.percentile(99)
+         << setw(9) << last_tenth.percentile(50)
+         << setw(9) << last_tenth.percentile(99)
+         << endl;
+}
 
-    constexpr double READ_RATIO = 0.80;
-    constexpr double INSERT_RATIO = 0.10;
-    constexpr double REMOVE_RATIO = 0.10;
+// Every engine with a fixed capacity under each of its configurations: the
+// load it reaches before its first forced resize, the displacements that
+// took, the memory left unused, and how add latency grows as it fills.
+void run_maxload(size_t capacity) {
+    cout << "\n=== Maximum Load Factor ===" << endl;
+    cout << "Distinct keys added on one thread to " << capacity
+         << " buckets until the first forced resize; latency in ns, path lengths need make STATS=1"
+         << endl << endl;
+
+    ofstream csv("maxload.csv");
+    csv << "engine,config,load,p50_ns,p99_ns,max_ns" << endl;
+    cout << left << setw(18) << "Table Type"
+         << setw(20) << "Config"
+         << setw(9) << "Keys"
+         << setw(7) << "Load"
+         << setw(7) << "Fill"
+         << setw(8) << "B/key"
+         << setw(8) << "Waste"
+         << setw(6) << "P50"
+         << setw(6) << "P99"
+         << setw(6) << "PMax"
+         << setw(9) << "<50% p50"
+         << setw(9) << "<50% p99"
+         << setw(9) << ">90% p50"
+         << setw(9) << ">90% p99"
+         << endl;
+    size_t width = 18 + 20 + 9 + 7 * 2 + 8 * 2 + 6 * 3 + 9 * 4;
+    cout << string(width, '-') << endl;
+
+    for (size_t reloc : {8, 16, 32}) {
+        string config = "R=" + to_string(reloc);
+        cuckoo_seq<int>::configure(reloc);
+        cuckoo_tx<int>::configure(reloc);
+        maxload_row<cuckoo_seq<int>>("cuckoo_seq", config, capacity, 1, csv);
+        maxload_row<cuckoo_tx<int>>("cuckoo_tx", config, capacity, 1, csv);
+    }
+    for (size_t reloc : {8, 16, 32}) {
+        for (size_t probe : {4, 8, 16}) {
+            for (size_t thresh : {probe / 4, probe / 2}) {
+                for (size_t limit : {5, 10, 20}) {
+                    string config = "R=" + to_string(reloc) + ",P=" + to_string(probe) +
+                                    ",T=" + to_string(thresh) + ",L=" + to_string(limit);
+                    cuckoo_striped<int>::configure(reloc, probe, thresh, limit);
+                    cuckoo_refinable<int>::configure(reloc, probe, thresh, limit);
+                    maxload_row<cuckoo_striped<int>>("cuckoo_striped", config, capacity, probe, csv);
+                    maxload_row<cuckoo_refinable<int>>("cuckoo_refinable", config, capacity, probe, csv);
+                }
+            }
+        }
+    }
+    for (size_t neighborhood : {4, 8, 16, 32}) {
+        string config = "H=" + to_string(neighborhood) + ",A=" + to_string(HOPSCOTCH_ADD_RANGE);
+        hopscotch_int::configure(neighborhood, HOPSCOTCH_ADD_RANGE);
+        maxload_row<hopscotch_int>("cuckoo_hopscotch", config, capacity, 1, csv);
+    }
+    cout << string(width, '-') << endl;
+    cout << "Load curve in maxload.csv" << endl;
+}
+
+void run_sweep(size_t initial_capacity, const vector<int>& initVals) {
 
     vector<size_t> options = {8, 16, 32};
 
     cout << "\n=== Full Configuration Sweep ===" << endl;
-    cout << "Workload: R/I/D = 80/10/10, Threads = " << NUM_THREADS << endl << endl;
+    cout << "Workload: R/I/D = 80/10/10, Threads = " << NUM_THREADS << endl;
+
+    // locked_set has nothing to configure, so it runs once
+    locked_set<int> locked(initial_capacity);
+    cout << "Baseline locked_set: " << fixed << setprecision(2)
+         << benchmark_concurrent(locked, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO)
+         << " ms" << endl << endl;
 
     cout << left << setw(25) << "Config (R/P/T/L)"
          << setw(12) << "Seq (ms)"
          << setw(14) << "Striped (ms)"
          << setw(16) << "Refinable (ms)"
          << setw(14) << "Tx (ms)"
+         << setw(14) << "Sharded (ms)"
+         << setw(16) << "Hopscotch (ms)"
          << endl;
-    cout << string(25 + 12 + 14 + 16 + 14, '-') << endl;
+    cout << string(25 + 12 + 14 + 16 + 14 + 14 + 16, '-') << endl;
 
     for (size_t reloc : options) {
         for (size_t probe : options) {
@@ -122,18 +1292,25 @@ int main() {
                     cuckoo_striped<int>::configure(reloc, probe, thresh, limit);
                     cuckoo_refinable<int>::configure(reloc, probe, thresh, limit);
                     cuckoo_tx<int>::configure(reloc);
+                    cuckoo_sharded<int>::configure(reloc);
+                    // P is cuckoo_hopscotch's neighborhood
+                    hopscotch_int::configure(probe, HOPSCOTCH_ADD_RANGE);
 
                     // Create tables
                     cuckoo_seq<int> seq(initial_capacity);
                     cuckoo_striped<int> striped(initial_capacity);
                     cuckoo_refinable<int> refinable(initial_capacity);
                     cuckoo_tx<int> tx(initial_capacity);
+                    cuckoo_sharded<int> sharded(initial_capacity);
+                    hopscotch_int hopscotch(initial_capacity);
 
                     // Run benchmarks
                     double seq_t = benchmark_seq(seq, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
                     double striped_t = benchmark_concurrent(striped, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
                     double refinable_t = benchmark_concurrent(refinable, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
                     double tx_t = benchmark_concurrent(tx, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+                    double sharded_t = benchmark_concurrent(sharded, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
+                    double hopscotch_t = benchmark_concurrent(hopscotch, initVals, READ_RATIO, INSERT_RATIO, REMOVE_RATIO);
 
                     cout << fixed << setprecision(2)
                          << setw(25)
@@ -145,13 +1322,77 @@ int main() {
                          << setw(14) << striped_t
                          << setw(16) << refinable_t
                          << setw(14) << tx_t
+                         << setw(14) << sharded_t
+                         << setw(16) << hopscotch_t
                          << endl;
                 }
             }
         }
     }
 
-    cout << string(25 + 12 + 14 + 16 + 14, '-') << endl;
+    cout << string(25 + 12 + 14 + 16 + 14 + 14 + 16, '-') << endl;
     cout << "Total configurations tested: " << (options.size() * options.size() * options.size() * options.size()) << endl;
+}
+
+// Usage: test_performance [sweep|latency|stats|counting|batch|filter|rcu|adaptive|memory] [num_ops]
+//        test_performance scaling [num_ops] [compact|scatter]
+//        test_performance stall [num_keys]
+//        test_performance maxload [capacity]
+//        test_performance trace gen <file> [num_ops] [seed]
+//                                          80/10/10 trace over NUM_KEYS
+//                                          preloaded keys
+//        test_performance trace convert <log> <file>
+//                                          text log, "<op> <key>" per line
+//        test_performance replay <file>    replay a trace, each thread its slice
+int main(int argc, char** argv) {
+    string mode = (argc > 1) ? argv[1] : "sweep";
+    if (mode == "stall") {
+        run_stall(argc > 2 ? stoi(argv[2]) : STALL_KEYS);
+        return 0;
+    }
+    if (mode == "maxload") {
+        run_maxload(argc > 2 ? stoul(argv[2]) : MAXLOAD_CAPACITY);
+        return 0;
+    }
+    try {
+        if (mode == "trace") return run_trace_tool(argc, argv);
+        if (mode == "replay" && argc > 2) {
+            run_replay(argv[2]);
+            return 0;
+        }
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+    if (argc > 2) num_ops = stoi(argv[2]);
+
+    size_t initial_capacity = 1024;
+    cout << "Generating test data..." << endl;
+    auto initVals = random_ints(NUM_KEYS, MAX_KEY);
+
+    if (mode == "sweep") {
+        run_sweep(initial_capacity, initVals);
+    } else if (mode == "latency") {
+        run_latency(initial_capacity, initVals);
+    } else if (mode == "stats") {
+        run_stats(initial_capacity, initVals);
+    } else if (mode == "counting") {
+        run_counting(initial_capacity);
+    } else if (mode == "batch") {
+        run_batch_mode(initial_capacity, initVals);
+    } else if (mode == "filter") {
+        run_filter(initial_capacity, initVals);
+    } else if (mode == "rcu") {
+        run_rcu(initial_capacity, initVals);
+    } else if (mode == "adaptive") {
+        run_adaptive(initial_capacity, initVals);
+    } else if (mode == "memory") {
+        run_memory(initial_capacity, initVals);
+    } else if (mode == "scaling") {
+        run_scaling(initial_capacity, initVals, argc > 3 ? argv[3] : "");
+    } else {
+        cerr << "Unknown mode: " << mode << endl;
+        return 1;
+    }
     cout << "All tests complete.\n";
 }
\ No newline at end of file
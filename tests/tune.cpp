@@ -0,0 +1,321 @@
+// Searches the configure() parameters of each engine for one workload.
+//
+// Usage: tune [name=value ...]
+//        tune workload_file [name=value ...]
+//
+// A workload file holds the same name=value pairs, one per line, with #
+// comments; pairs on the command line override it. Names:
+//   reads, inserts, removes   operation mix, normalized to sum to 1
+//   keys                      keys loaded before each trial
+//   key_range                 keys are drawn from [0, key_range]
+//   threads                   threads issuing operations (default: cores)
+//   ops                       operations per trial
+//   capacity                  initial capacity of each table
+//   engines                   comma list of seq,striped,refinable,tx
+//   trials                    trials per candidate in the first round
+//   eta                       candidates kept per round: 1 / eta
+//   seed                      seed of the key and operation streams
+//   trace                     replay this trace file (see test_performance
+//                             trace) instead: its preload is loaded before
+//                             each trial and each thread replays its slice
+//                             of its ops, so the mix, keys, key_range and
+//                             ops above are unused
+//
+// Candidates are R/P/T/L points (MAX_RELOCATIONS, PROBE_SIZE, THRESHOLD,
+// LIMIT; cuckoo_seq and cuckoo_tx only have R). The search is successive
+// halving: every surviving candidate runs its trials for the round, in a
+// shuffled order so drift in the machine is spread over all of them, the
+// best 1 / eta by mean throughput go on, and the next round doubles the
+// trials. Throughput is reported as a mean with a 95% confidence interval
+// over all of a candidate's trials; "overlaps" flags a runner-up whose
+// interval meets the winner's, i.e. one the data cannot separate from it.
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <random>
+#include <span>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <memory>
+#include <vector>
+#include "cuckoo_seq.h"
+#include "cuckoo_striped.h"
+#include "cuckoo_refinable.h"
+#include "cuckoo_tx.h"
+#include "op_trace.h"
+
+using namespace std;
+using namespace cuckoo;
+
+struct workload {
+    double reads = 0.80;
+    double inserts = 0.10;
+    double removes = 0.10;
+    size_t keys = 200000;
+    int key_range = 1000000;
+    int threads = max(1u, thread::hardware_concurrency());
+    size_t ops = 1000000;
+    size_t capacity = 1024;
+    vector<string> engines = {"seq", "striped", "refinable", "tx"};
+    size_t trials = 2;
+    size_t eta = 3;
+    unsigned seed = 1;
+    string trace;
+};
+
+struct candidate {
+    size_t reloc, probe, thresh, limit;
+    vector<double> mops; // one per trial
+
+    string name() const {
+        if (probe == 0) return "R=" + to_string(reloc);
+        return "R=" + to_string(reloc) + ",P=" + to_string(probe) +
+               ",T=" + to_string(thresh) + ",L=" + to_string(limit);
+    }
+
+    double mean() const {
+        double sum = 0;
+        for (double m : mops) sum += m;
+        return sum / mops.size();
+    }
+
+    // Half-width of the 95% confidence interval of mean(), Student's t
+    double half_width() const {
+        size_t n = mops.size();
+        if (n < 2) return numeric_limits<double>::infinity();
+        double m = mean(), var = 0;
+        for (double x : mops) var += (x - m) * (x - m);
+        var /= n - 1;
+        static const double t95[] = {12.71, 4.30, 3.18, 2.78, 2.57, 2.45, 2.36, 2.31, 2.26, 2.23,
+                                     2.20, 2.18, 2.16, 2.14, 2.13, 2.12, 2.11, 2.10, 2.09, 2.09,
+                                     2.08, 2.07, 2.07, 2.06, 2.06, 2.06, 2.05, 2.05, 2.05, 2.04};
+        double t = n - 1 <= size(t95) ? t95[n - 2] : 1.96;
+        return t * sqrt(var / n);
+    }
+};
+
+void set_param(workload& w, const string& name, const string& value) {
+    if (name == "reads") w.reads = stod(value);
+    else if (name == "inserts") w.inserts = stod(value);
+    else if (name == "removes") w.removes = stod(value);
+    else if (name == "keys") w.keys = stoul(value);
+    else if (name == "key_range") w.key_range = stoi(value);
+    else if (name == "threads") w.threads = stoi(value);
+    else if (name == "ops") w.ops = stoul(value);
+    else if (name == "capacity") w.capacity = stoul(value);
+    else if (name == "trials") w.trials = max<size_t>(2, stoul(value));
+    else if (name == "eta") w.eta = max<size_t>(2, stoul(value));
+    else if (name == "seed") w.seed = stoul(value);
+    else if (name == "trace") w.trace = value;
+    else if (name == "engines") {
+        w.engines.clear();
+        stringstream ss(value);
+        for (string e; getline(ss, e, ',');) w.engines.push_back(e);
+    }
+    else throw invalid_argument("unknown workload parameter: " + name);
+}
+
+// Applies one "name=value" pair; blank lines and # comments are skipped.
+void parse_pair(workload& w, string line) {
+    line = line.substr(0, line.find('#'));
+    line.erase(remove_if(line.begin(), line.end(), ::isspace), line.end());
+    if (line.empty()) return;
+    size_t eq = line.find('=');
+    if (eq == string::npos) throw invalid_argument("expected name=value: " + line);
+    set_param(w, line.substr(0, eq), line.substr(eq + 1));
+}
+
+workload parse_workload(int argc, char** argv) {
+    workload w;
+    int first = 1;
+    if (argc > 1 && string(argv[1]).find('=') == string::npos) {
+        ifstream in(argv[1]);
+        if (!in) throw invalid_argument(string("cannot read ") + argv[1]);
+        for (string line; getline(in, line);) parse_pair(w, line);
+        first = 2;
+    }
+    for (int i = first; i < argc; ++i) parse_pair(w, argv[i]);
+    double total = w.reads + w.inserts + w.removes;
+    w.reads /= total;
+    w.inserts /= total;
+    w.removes /= total;
+    return w;
+}
+
+template<typename Table>
+void configure(const candidate& c) {
+    if constexpr (requires { Table::configure(c.reloc, c.probe, c.thresh, c.limit); })
+        Table::configure(c.reloc, c.probe, c.thresh, c.limit);
+    else
+        Table::configure(c.reloc);
+}
+
+// Runs ops against table, as test_performance's replay does. Returns the
+// lookups that hit, so none of them can be optimized away.
+template<typename Table>
+size_t replay(Table& table, span<const bench::trace_record> ops) {
+    size_t hits = 0;
+    for (const bench::trace_record& r : ops) {
+        if (r.op == bench::OP_CONTAINS) hits += table.contains(r.key);
+        else if (r.op == bench::OP_ADD) table.add(r.key);
+        else table.remove(r.key);
+    }
+    return hits;
+}
+
+// One trial: load the keys, then run the operation mix on numThreads threads,
+// or with a trace each thread its slice of it. Returns millions of operations
+// per second.
+template<typename Table>
+double trial(const workload& w, int numThreads, const candidate& c, const vector<int>& initial,
+             const bench::mapped_trace* trace, unsigned seed) {
+    configure<Table>(c);
+    Table table(w.capacity);
+    for (int k : initial) table.add(k);
+
+    vector<thread> threads;
+    atomic<size_t> hits{0};
+    auto start = chrono::steady_clock::now();
+    for (int t = 0; t < numThreads; ++t) {
+        threads.emplace_back([&, t]() {
+            if (trace) {
+                hits += replay(table, trace->slice(t, numThreads));
+                return;
+            }
+            mt19937 rng(seed * 7919 + t);
+            uniform_int_distribution<int> keyDist(0, w.key_range);
+            uniform_real_distribution<double> opDist(0.0, 1.0);
+            for (size_t i = 0; i < w.ops / numThreads; ++i) {
+                double op = opDist(rng);
+                int key = keyDist(rng);
+                if (op < w.reads) table.contains(key);
+                else if (op < w.reads + w.inserts) table.add(key);
+                else table.remove(key);
+            }
+        });
+    }
+    for (auto& th : threads) th.join();
+    double ms = chrono::duration<double, milli>(chrono::steady_clock::now() - start).count();
+    return (trace ? trace->ops().size() : w.ops) / ms / 1000;
+}
+
+vector<candidate> candidates(bool probe_sets) {
+    vector<candidate> out;
+    for (size_t reloc : {4, 8, 16, 32}) {
+        if (!probe_sets) {
+            out.push_back({reloc, 0, 0, 0, {}});
+            continue;
+        }
+        for (size_t probe : {4, 8, 16, 32})
+            for (size_t thresh : {2, 4, 8, 16, 32})
+                for (size_t limit : {4, 8, 16, 32})
+                    if (thresh <= probe) out.push_back({reloc, probe, thresh, limit, {}});
+    }
+    return out;
+}
+
+void print_row(const candidate& c, const candidate& best) {
+    bool overlaps = &c != &best
+                    && c.mean() + c.half_width() >= best.mean() - best.half_width();
+    cout << fixed << setprecision(3)
+         << setw(28) << c.name()
+         << setw(12) << c.mean()
+         << setw(12) << c.half_width()
+         << setw(8) << c.mops.size()
+         << (overlaps ? "overlaps" : "") << endl;
+}
+
+template<typename Table>
+void tune(const string& name, const workload& w, const vector<int>& initial,
+          const bench::mapped_trace* trace, int numThreads, bool probe_sets) {
+    vector<candidate> pool = candidates(probe_sets);
+    vector<candidate*> alive;
+    for (candidate& c : pool) alive.push_back(&c);
+    cout << "\n=== " << name << ": " << pool.size() << " candidates, " << numThreads
+         << (numThreads == 1 ? " thread" : " threads") << " ===" << endl;
+
+    mt19937 order_rng(w.seed);
+    unsigned trial_seed = w.seed;
+    size_t trials = w.trials;
+    vector<candidate*> finalists;
+    for (int round = 0; alive.size() > 1 || round == 0; ++round) {
+        vector<candidate*> runs;
+        for (candidate* c : alive)
+            for (size_t i = 0; i < trials; ++i) runs.push_back(c);
+        shuffle(runs.begin(), runs.end(), order_rng);
+        for (candidate* c : runs) c->mops.push_back(trial<Table>(w, numThreads, *c, initial, trace, trial_seed++));
+
+        sort(alive.begin(), alive.end(), [](const candidate* a, const candidate* b) {
+            return a->mean() > b->mean();
+        });
+        cout << "Round " << round << ": " << alive.size() << " candidates x " << trials
+             << " trials, best " << alive[0]->name() << " at " << fixed << setprecision(3)
+             << alive[0]->mean() << " Mops/s" << endl;
+        finalists = alive;
+        alive.resize(max<size_t>(1, alive.size() / w.eta));
+        trials *= 2;
+    }
+
+    // the last round's candidates all ran the same trials
+    const candidate& best = *finalists[0];
+    cout << endl << left << setw(28) << "Config (R/P/T/L)"
+         << setw(12) << "Mops/s"
+         << setw(12) << "+/- 95%"
+         << setw(8) << "Trials" << endl;
+    cout << string(28 + 12 + 12 + 8 + 8, '-') << endl;
+    for (size_t i = 0; i < finalists.size() && i < 5; ++i) print_row(*finalists[i], best);
+    cout << string(28 + 12 + 12 + 8 + 8, '-') << endl;
+    if (probe_sets)
+        cout << name << "<Key>::configure(" << best.reloc << ", " << best.probe << ", "
+             << best.thresh << ", " << best.limit << ");" << endl;
+    else
+        cout << name << "<Key>::configure(" << best.reloc << ");" << endl;
+}
+
+int main(int argc, char** argv) {
+    workload w;
+    unique_ptr<bench::mapped_trace> trace;
+    try {
+        w = parse_workload(argc, argv);
+        if (!w.trace.empty()) trace = make_unique<bench::mapped_trace>(w.trace);
+    } catch (const exception& e) {
+        cerr << e.what() << endl;
+        return 1;
+    }
+
+    vector<int> initial;
+    if (trace) {
+        cout << "Workload: trace " << w.trace << ", " << trace->preload().size()
+             << " preloaded keys, threads = " << w.threads << ", ops/trial = "
+             << trace->ops().size() << endl;
+        for (const bench::trace_record& r : trace->preload()) initial.push_back(r.key);
+    } else {
+        cout << "Workload: R/I/D = " << setprecision(2) << fixed << w.reads * 100 << "/"
+             << w.inserts * 100 << "/" << w.removes * 100 << ", keys = " << w.keys
+             << ", key range = " << w.key_range << ", threads = " << w.threads
+             << ", ops/trial = " << w.ops << endl;
+        mt19937 rng(w.seed);
+        uniform_int_distribution<int> keyDist(0, w.key_range);
+        initial.resize(w.keys);
+        for (int& k : initial) k = keyDist(rng);
+    }
+
+    for (const string& e : w.engines) {
+        // cuckoo_seq is not thread-safe
+        if (e == "seq") tune<cuckoo_seq<int>>("cuckoo_seq", w, initial, trace.get(), 1, false);
+        else if (e == "striped") tune<cuckoo_striped<int>>("cuckoo_striped", w, initial, trace.get(), w.threads, true);
+        else if (e == "refinable") tune<cuckoo_refinable<int>>("cuckoo_refinable", w, initial, trace.get(), w.threads, true);
+        else if (e == "tx") tune<cuckoo_tx<int>>("cuckoo_tx", w, initial, trace.get(), w.threads, false);
+        else cerr << "Unknown engine: " << e << endl;
+    }
+    return 0;
+}